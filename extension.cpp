@@ -33,6 +33,7 @@
 #include "extension.h"
 #include <dt_send.h>
 #include <unordered_map>
+#include <map>
 #include <vector>
 #include <mathlib/vector.h>
 #include <iserverentity.h>
@@ -48,9 +49,12 @@
 #include <igameevents.h>
 #include <cstdlib>
 #include <mutex>
-#include <thread>
-#include <pthread.h>
+#include <atomic>
+#include <bitset>
+#include <array>
+#include <type_traits>
 #include <ISDKTools.h>
+#include <tier0/vprof.h>
 
 /**
  * @file extension.cpp
@@ -167,18 +171,45 @@ static bool is_prop_cond(const SendProp *pProp)
 }
 #endif
 
+struct proxyrestore_t;
+
+static void send_proxy(const proxyrestore_t &restore, const SendProp *pProp, const void *pStructBase, const void *pData, DVariant *pOut, int iElement, int objectID);
+
+//one proxy per restore index so hooked props reach their proxyrestore_t without a lookup
+//props past the last slot fall back to global_send_proxy
+static constexpr std::size_t proxy_thunk_count{256};
+static std::array<const proxyrestore_t *, proxy_thunk_count> proxy_thunk_restores{};
+
+template <std::size_t N>
+static void proxy_thunk(const SendProp *pProp, const void *pStructBase, const void *pData, DVariant *pOut, int iElement, int objectID)
+{ send_proxy(*proxy_thunk_restores[N], pProp, pStructBase, pData, pOut, iElement, objectID); }
+
+template <std::size_t ...I>
+static std::array<SendVarProxyFn, sizeof...(I)> make_proxy_thunks(std::index_sequence<I...>) noexcept
+{ return {{proxy_thunk<I>...}}; }
+
+static const std::array<SendVarProxyFn, proxy_thunk_count> proxy_thunks{make_proxy_thunks(std::make_index_sequence<proxy_thunk_count>{})};
+
+static bool is_own_proxy(SendVarProxyFn pProxy) noexcept
+{ return (pProxy == global_send_proxy || std::find(proxy_thunks.cbegin(), proxy_thunks.cend(), pProxy) != proxy_thunks.cend()); }
+
 struct proxyrestore_t final
 {
 	inline proxyrestore_t(proxyrestore_t &&other) noexcept
 	{ operator=(std::move(other)); }
 
-	proxyrestore_t(SendProp *pProp_, prop_types type_) noexcept
-		: pProp{pProp_}, pRealProxy{pProp->GetProxyFn()}, type{type_}
+	proxyrestore_t(SendProp *pProp_, prop_types type_, std::size_t index_) noexcept
+		: pProp{pProp_}, pRealProxy{pProp->GetProxyFn()}, type{type_}, index{index_}
 	{
 	#ifdef _DEBUG
 		printf("set %s proxy func\n", pProp->GetName());
 	#endif
-		pProp->SetProxyFn(global_send_proxy);
+		if(index < proxy_thunk_count) {
+			proxy_thunk_restores[index] = this;
+			pProp->SetProxyFn(proxy_thunks[index]);
+		} else {
+			pProp->SetProxyFn(global_send_proxy);
+		}
 	}
 
 	~proxyrestore_t() noexcept {
@@ -187,6 +218,9 @@ struct proxyrestore_t final
 			printf("reset %s proxy func\n", pProp->GetName());
 		#endif
 			pProp->SetProxyFn(pRealProxy);
+			if(index < proxy_thunk_count && proxy_thunk_restores[index] == this) {
+				proxy_thunk_restores[index] = nullptr;
+			}
 		}
 	}
 
@@ -197,6 +231,7 @@ struct proxyrestore_t final
 		pRealProxy = other.pRealProxy;
 		other.pRealProxy = nullptr;
 		type = other.type;
+		index = other.index;
 		return *this;
 	}
 
@@ -204,6 +239,7 @@ struct proxyrestore_t final
 	SendVarProxyFn pRealProxy{nullptr};
 	std::size_t ref{0};
 	prop_types type{prop_types::unknown};
+	std::size_t index{0};
 
 private:
 	proxyrestore_t(const proxyrestore_t &) = delete;
@@ -214,6 +250,53 @@ private:
 using restores_t = std::unordered_map<SendProp *, std::unique_ptr<proxyrestore_t>>;
 static restores_t restores;
 
+//sorted by prop so global_send_proxy and the prop type checks can reach the restore without hashing
+using restore_lookup_t = std::vector<std::pair<const SendProp *, proxyrestore_t *>>;
+static restore_lookup_t restore_lookup;
+
+static bool restore_lookup_compare(const restore_lookup_t::value_type &lhs, const SendProp *rhs) noexcept
+{ return std::less<const SendProp *>{}(lhs.first, rhs); }
+
+static proxyrestore_t *find_restore(const SendProp *pProp) noexcept
+{
+	restore_lookup_t::const_iterator it{std::lower_bound(restore_lookup.cbegin(), restore_lookup.cend(), pProp, restore_lookup_compare)};
+	if(it == restore_lookup.cend() || it->first != pProp) {
+		return nullptr;
+	}
+	return it->second;
+}
+
+//every hooked prop gets a dense index so per-entity callback tables can be plain arrays
+//indices of unhooked props are reused to keep those tables small
+static std::size_t restore_index_count{0};
+static std::vector<std::size_t> free_restore_indices;
+
+static void add_restore_lookup(proxyrestore_t *restore) noexcept
+{
+	restore_lookup_t::iterator it{std::lower_bound(restore_lookup.begin(), restore_lookup.end(), restore->pProp, restore_lookup_compare)};
+	restore_lookup.emplace(it, restore->pProp, restore);
+}
+
+static std::size_t alloc_restore_index() noexcept
+{
+	if(free_restore_indices.empty()) {
+		return restore_index_count++;
+	}
+
+	const std::size_t index{free_restore_indices.back()};
+	free_restore_indices.pop_back();
+	return index;
+}
+
+static void remove_restore_lookup(proxyrestore_t *restore) noexcept
+{
+	restore_lookup_t::iterator it{std::lower_bound(restore_lookup.begin(), restore_lookup.end(), restore->pProp, restore_lookup_compare)};
+	if(it != restore_lookup.end() && it->second == restore) {
+		restore_lookup.erase(it);
+		free_restore_indices.emplace_back(restore->index);
+	}
+}
+
 static SendVarProxyFn SendProxy_StringT_To_String_ptr{nullptr};
 static SendVarProxyFn SendProxy_Color32ToInt_ptr{nullptr};
 static SendVarProxyFn SendProxy_EHandleToInt_ptr{nullptr};
@@ -225,9 +308,9 @@ static prop_types guess_prop_type(const SendProp *pProp, const SendTable *pTable
 #endif
 
 	SendVarProxyFn pRealProxy{pProp->GetProxyFn()};
-	if(pRealProxy == global_send_proxy) {
-		restores_t::const_iterator it_restore{restores.find(const_cast<SendProp *>(pProp))};
-		if(it_restore == restores.cend()) {
+	if(is_own_proxy(pRealProxy)) {
+		const proxyrestore_t *restore{find_restore(pProp)};
+		if(!restore) {
 		#if defined _DEBUG
 			printf("invalid (global send proxy)\n");
 		#endif
@@ -237,7 +320,7 @@ static prop_types guess_prop_type(const SendProp *pProp, const SendTable *pTable
 	#if defined _DEBUG
 		printf("from restore (global send proxy)\n");
 	#endif
-		return it_restore->second->type;
+		return restore->type;
 	}
 
 #if SOURCE_ENGINE == SE_TF2
@@ -398,405 +481,516 @@ proxysend::prop_types Sample::guess_prop_type(const SendProp *prop, const SendTa
 	return ::guess_prop_type(prop, table);
 }
 
-template <typename T>
-class thread_var_base
+CBaseEntity *ReferenceToEntity(unsigned long ref)
 {
-protected:
-	using ptr_ret_t = std::conditional_t<std::is_pointer<T>::value, T, T *>;
+	union {
+		cell_t sp_val;
+		unsigned long e_val;
+	} u;
 
-public:
-	inline void reset(std::nullptr_t) noexcept
-	{ reset_ptr(nullptr); }
+	u.e_val = ref;
 
-	thread_var_base &operator=(std::nullptr_t) noexcept
-	{
-		reset_ptr(nullptr);
-		return *this;
-	}
+	return gamehelpers->ReferenceToEntity(u.sp_val);
+}
 
-	inline thread_var_base(std::nullptr_t) noexcept
-		: thread_var_base{}
-	{
-	}
+unsigned long EntityToReference(CBaseEntity *ent)
+{
+	union {
+		cell_t sp_val;
+		unsigned long e_val;
+	} u;
 
-	inline thread_var_base() noexcept
-	{
-	}
+	u.sp_val = gamehelpers->EntityToReference(ent);
 
-	inline bool operator!() const noexcept;
+	return u.e_val;
+}
 
-	inline ptr_ret_t operator->() noexcept
-	{ return get_ptr(); }
+int ReferenceToIndex(unsigned long ref)
+{
+	union {
+		cell_t sp_val;
+		unsigned long e_val;
+	} u;
 
-	inline ~thread_var_base() noexcept
-	{
-		if(allocated_) {
-			unallocate();
-		}
-	}
+	u.e_val = ref;
+
+	return gamehelpers->ReferenceToIndex(u.sp_val);
+}
+
+unsigned long IndexToReference(int objectID)
+{
+	union {
+		cell_t sp_val;
+		unsigned long e_val;
+	} u;
+
+	u.sp_val = gamehelpers->IndexToReference(objectID);
 
-protected:
-	static constexpr const pthread_key_t invalid_key{PTHREAD_KEYS_MAX+1};
+	return u.e_val;
+}
 
-	pthread_key_t key{invalid_key};
-	bool allocated_{false};
+//a PackedEntity that borrows everything from the snapshot's shared one except the data
+//so WriteDeltaEntities can be handed per-client data without touching the heap
+struct packed_entity_shadow_t final
+{
+	PackedEntity entity{};
+	std::atomic<bool> ready{false};
 
-	static void dtor(void *ptr) noexcept
-	{ delete reinterpret_cast<T *>(ptr); }
+	packed_entity_shadow_t() noexcept = default;
+	~packed_entity_shadow_t() noexcept
+	{ entity.ClearShadow(); }
 
-	T *get_ptr_raw() const noexcept
+	PackedEntity *get(PackedEntity *shared, char *packedData, int nBytes, std::mutex &mtx) noexcept
 	{
-		if(!allocated_) {
-			return nullptr;
+		//several clients can ask for the same shadow when sv_parallel_sendsnapshot is on
+		if(!ready.load(std::memory_order_acquire)) {
+			std::lock_guard<std::mutex> lock{mtx};
+			if(!ready.load(std::memory_order_relaxed)) {
+				entity.ShadowFrom(shared, packedData, PAD_NUMBER(nBytes, 4) * 8);
+				ready.store(true, std::memory_order_release);
+			}
 		}
-		return reinterpret_cast<T *>(pthread_getspecific(key));
+		return &entity;
 	}
 
-	ptr_ret_t get_ptr() const noexcept
+	void clear() noexcept
 	{
-		T *ptr{get_ptr_raw()};
-		if(!ptr) {
-			return nullptr;
-		}
-	#if 0
-		if constexpr(std::is_pointer_v<T>) {
-			return *ptr;
-		} else
-	#endif
-		{
-			return ptr;
-		}
+		entity.ClearShadow();
+		ready.store(false, std::memory_order_relaxed);
+	}
+
+private:
+	packed_entity_shadow_t(const packed_entity_shadow_t &) = delete;
+	packed_entity_shadow_t &operator=(const packed_entity_shadow_t &) = delete;
+	packed_entity_shadow_t(packed_entity_shadow_t &&) = delete;
+	packed_entity_shadow_t &operator=(packed_entity_shadow_t &&) = delete;
+};
+
+struct packed_entity_data_t final
+{
+	char *packedData{nullptr};
+	int nBits{0};
+	int nBytes{0};
+	//the slot whose callback results are used to encode this data
+	int slot{-1};
+	packed_entity_shadow_t *shadow{nullptr};
+	//last tick's data for the same clients, used when the entity is not encoded again
+	const packed_entity_data_t *prev{nullptr};
+
+	bool written() const noexcept
+	{ return (packedData && nBits > 0); }
+
+	void reset(int slot_) noexcept {
+		packedData = nullptr;
+		nBits = 0;
+		nBytes = 0;
+		slot = slot_;
+		shadow = nullptr;
+		prev = nullptr;
 	}
+};
+
+//clients that got the exact same callback results share one encode
+struct entity_packs_t final
+{
+	unsigned long ref{INVALID_EHANDLE_INDEX};
+	int edict{-1};
+	std::vector<packed_entity_data_t> classes{};
+	//index into classes for every entry of pack_entity_params_t::slots, -1 means the global data is used
+	std::vector<int> slot_class{};
 
-	T *get_or_allocate_ptr() noexcept
+	const packed_entity_data_t *get(std::size_t slot_idx) const noexcept
 	{
-		if(!allocated_ && !allocate()) {
+		const int class_idx{slot_class[slot_idx]};
+		if(class_idx == -1) {
 			return nullptr;
 		}
-		T *ptr{reinterpret_cast<T *>(pthread_getspecific(key))};
-		if(!ptr) {
-			ptr = new T{};
-			pthread_setspecific(key, ptr);
+		const packed_entity_data_t &data{classes[static_cast<std::size_t>(class_idx)]};
+		if(!data.written()) {
+			return nullptr;
 		}
-		return ptr;
+		return &data;
 	}
+};
+
+//bump allocator for the per-client packed data of a tick
+//chunks are kept around between ticks so after warmup packing does not touch the heap
+//workers only bump the offset of the current chunk, the lock is taken to move to the next one
+class packed_data_arena_t final
+{
+public:
+	static constexpr const std::size_t chunk_size{MAX_PACKEDENTITY_DATA * 4};
 
-	bool allocate() noexcept
+	packed_data_arena_t() noexcept = default;
+	~packed_data_arena_t() noexcept = default;
+
+	char *allocate(std::size_t size) noexcept
 	{
-		if(!__sync_bool_compare_and_swap(&allocated_, 0, 1)) {
-			return true;
-		}
-		if(pthread_key_create(&key, dtor) != 0) {
-			return false;
+		size = PAD_NUMBER(size, 4);
+
+		while(true) {
+			chunk_t *current{current_chunk.load(std::memory_order_acquire)};
+			if(current) {
+				//can go past the end when the chunk is full, it is reset before being reused
+				const std::size_t offset{current->offset.fetch_add(size, std::memory_order_relaxed)};
+				if(offset + size <= chunk_size) {
+					return current->data.get() + offset;
+				}
+			}
+
+			std::lock_guard<std::mutex> lock{mtx};
+			if(current_chunk.load(std::memory_order_relaxed) != current) {
+				continue;
+			}
+
+			if(current) {
+				++chunk;
+			}
+			if(chunk == chunks.size()) {
+				chunks.emplace_back(new chunk_t{});
+			}
+			chunk_t *next{chunks[chunk].get()};
+			next->offset.store(0, std::memory_order_relaxed);
+			current_chunk.store(next, std::memory_order_release);
 		}
-		pthread_setspecific(key, new T{});
-		return true;
 	}
 
-	bool unallocate() noexcept
+	void reset() noexcept
 	{
-		if(!__sync_bool_compare_and_swap(&allocated_, 1, 0)) {
-			return true;
-		}
-		T *old_ptr{reinterpret_cast<T *>(pthread_getspecific(key))};
-		if(old_ptr) {
-			delete old_ptr;
+		chunk = 0;
+		if(chunks.empty()) {
+			current_chunk.store(nullptr, std::memory_order_relaxed);
+		} else {
+			chunks[0]->offset.store(0, std::memory_order_relaxed);
+			current_chunk.store(chunks[0].get(), std::memory_order_relaxed);
 		}
-		return (pthread_key_delete(key) == 0);
 	}
 
-	void reset_ptr(T *ptr) noexcept
+	void clear() noexcept
 	{
-		T *old_ptr{get_ptr_raw()};
-		if(old_ptr) {
-			delete old_ptr;
-		}
-		if(!allocated_ && !allocate()) {
-			return;
-		}
-		pthread_setspecific(key, ptr);
+		current_chunk.store(nullptr, std::memory_order_relaxed);
+		chunk = 0;
+		chunks.clear();
 	}
 
 private:
-	thread_var_base(const thread_var_base &) = delete;
-	thread_var_base &operator=(const thread_var_base &) = delete;
-	thread_var_base(thread_var_base &&) = delete;
-	thread_var_base &operator=(thread_var_base &&) = delete;
-};
+	struct chunk_t final
+	{
+		std::unique_ptr<char[]> data{new char[chunk_size]};
+		std::atomic<std::size_t> offset{0};
+	};
 
-template <>
-inline bool thread_var_base<bool>::operator!() const noexcept
-{
-	const bool *ptr{get_ptr_raw()};
-	return (!ptr || !*ptr);
-}
+	std::vector<std::unique_ptr<chunk_t>> chunks{};
+	std::atomic<chunk_t *> current_chunk{nullptr};
+	std::size_t chunk{0};
+	std::mutex mtx{};
 
-template <typename T>
-inline bool thread_var_base<T>::operator!() const noexcept
-{ return get_ptr() == nullptr; }
+	packed_data_arena_t(const packed_data_arena_t &) = delete;
+	packed_data_arena_t &operator=(const packed_data_arena_t &) = delete;
+	packed_data_arena_t(packed_data_arena_t &&) = delete;
+	packed_data_arena_t &operator=(packed_data_arena_t &&) = delete;
+};
 
-template <typename T>
-class thread_var final : public thread_var_base<T>
+struct pack_entity_params_t final
 {
-public:
-	using thread_var_base<T>::thread_var_base;
-	using thread_var_base<T>::reset;
+	std::vector<entity_packs_t> entity_data{};
+	std::vector<int> slots{};
+	std::vector<unsigned long> entities{};
+	int snapshot_index{-1};
 
-	template <typename ...Args>
-	T &reset(Args &&...args) noexcept
+	//last tick's data, a client whose value went back to the global one still needs the prop resent
+	std::vector<entity_packs_t> prev_entity_data{};
+	std::vector<unsigned long> prev_entities{};
+
+	pack_entity_params_t() noexcept
 	{
-		T *ptr{this->get_or_allocate_ptr()};
-		ptr->~T();
-		new (ptr) T{std::forward<Args>(args)...};
-		return *ptr;
+		slot_table.fill(-1);
+		edict_tables[0].fill(-1);
+		edict_tables[1].fill(-1);
 	}
 
-	inline thread_var() noexcept
-		: thread_var_base<T>{}
+	~pack_entity_params_t() noexcept = default;
+
+	void begin_tick(std::vector<int> &&slots_, std::vector<unsigned long> &&entities_, int snapshot_index_) noexcept
 	{
-	}
+		release_shadows();
+
+		//only undo the entries that were set instead of refilling the whole tables
+		for(int slot : slots) {
+			slot_table[static_cast<std::size_t>(slot)] = -1;
+		}
+		for(const entity_packs_t &packs : prev_entity_data) {
+			if(packs.edict != -1) {
+				edict_tables[current_arena ^ 1][static_cast<std::size_t>(packs.edict)] = -1;
+			}
+		}
 
-	inline thread_var(const T &val) noexcept
-	{ *this->get_or_allocate_ptr() = val; }
+		std::swap(entity_data, prev_entity_data);
+		std::swap(entities, prev_entities);
 
-	inline thread_var(T &&val) noexcept
-	{ *this->get_or_allocate_ptr() = std::move(val); }
+		slots = std::move(slots_);
+		entities = std::move(entities_);
+		snapshot_index = snapshot_index_;
 
-	template <typename ...Args>
-	inline thread_var(Args &&...args) noexcept
-	{
-		T *ptr{this->get_or_allocate_ptr()};
-		ptr->~T();
-		new (ptr) T{std::forward<Args>(args)...};
+		//the other arena and edict table still belong to prev_entity_data
+		current_arena ^= 1;
+		arenas[current_arena].reset();
+
+		const std::size_t slots_size{slots.size()};
+		for(std::size_t i{0}; i < slots_size; ++i) {
+			slot_table[static_cast<std::size_t>(slots[i])] = static_cast<int>(i);
+		}
+
+		//presize everything here so SendTable_Encode never grows a vector from a pack worker
+		const std::size_t entities_size{entities.size()};
+		entity_data.resize(entities_size);
+		for(std::size_t i{0}; i < entities_size; ++i) {
+			entity_packs_t &packs{entity_data[i]};
+			packs.ref = entities[i];
+			packs.edict = ::ReferenceToIndex(packs.ref);
+			if(packs.edict < 0 || packs.edict >= MAX_EDICTS) {
+				packs.edict = -1;
+			} else {
+				edict_tables[current_arena][static_cast<std::size_t>(packs.edict)] = static_cast<int>(i);
+			}
+			packs.classes.clear();
+			packs.slot_class.assign(slots_size, -1);
+		}
 	}
 
-	thread_var &operator=(std::nullptr_t) noexcept
+	//must run on the main thread once the classes of this tick are final
+	void assign_shadows() noexcept
 	{
-		this->reset_ptr(nullptr);
-		return *this;
+		for(entity_packs_t &packs : entity_data) {
+			for(packed_entity_data_t &data : packs.classes) {
+				if(shadows_used == shadows.size()) {
+					shadows.emplace_back(new packed_entity_shadow_t{});
+				}
+				data.shadow = shadows[shadows_used++].get();
+			}
+		}
 	}
 
-	thread_var &operator=(const T &val) noexcept
+	//the shadows borrow the change frame lists of the snapshot so they cannot outlive the send
+	void release_shadows() noexcept
 	{
-		*this->get_or_allocate_ptr() = val;
-		return *this;
+		for(std::size_t i{0}; i < shadows_used; ++i) {
+			shadows[i]->clear();
+		}
+		shadows_used = 0;
 	}
 
-	thread_var &operator=(T &&val) noexcept
+	PackedEntity *get_shadow(PackedEntity *shared, const packed_entity_data_t &data) noexcept
+	{ return data.shadow->get(shared, data.packedData, data.nBytes, shadows_mtx); }
+
+	void store(packed_entity_data_t &data, bf_write &writeBuf) noexcept
 	{
-		*this->get_or_allocate_ptr() = std::move(val);
-		return *this;
+		data.nBits = writeBuf.GetNumBitsWritten();
+		data.nBytes = writeBuf.GetNumBytesWritten();
+		const std::size_t nBytes{static_cast<std::size_t>(data.nBytes)};
+		const std::size_t nPadded{PAD_NUMBER(nBytes, 4)};
+		data.packedData = arenas[current_arena].allocate(nPadded);
+		memcpy(data.packedData, writeBuf.GetBasePointer(), nBytes);
+		memset(data.packedData + nBytes, 0, nPadded - nBytes);
 	}
 
-	inline T &operator*() noexcept
-	{ return *this->get_ptr_raw(); }
-
-	inline T &get() noexcept
-	{ return *this->get_ptr_raw(); }
+	//an entity that is not encoded again had the same callback results as last tick
+	//so every class can reuse the data of last tick's class its first client was in
+	//false if a class has nothing to reuse, the entity then has to be encoded
+	bool link_prev(entity_packs_t &packs) noexcept
+	{
+		const std::size_t prev_idx{prev_entity_index(packs.edict, packs.ref)};
+
+		bool linked{true};
+		const std::size_t classes_size{packs.classes.size()};
+		for(std::size_t i{0}; i < classes_size; ++i) {
+			packed_entity_data_t &data{packs.classes[i]};
+			data.prev = nullptr;
+			if(prev_idx != static_cast<std::size_t>(-1)) {
+				for(const packed_entity_data_t &prev_data : prev_entity_data[prev_idx].classes) {
+					if(!prev_data.written()) {
+						continue;
+					}
+					const std::size_t slot_idx{slot_index(prev_data.slot)};
+					if(slot_idx != static_cast<std::size_t>(-1) && packs.slot_class[slot_idx] == static_cast<int>(i)) {
+						data.prev = &prev_data;
+						break;
+					}
+				}
+			}
+			if(!data.prev) {
+				linked = false;
+			}
+		}
+		return linked;
+	}
 
-	inline operator T &() noexcept
-	{ return *this->get_ptr_raw(); }
+	//copied since the arena last tick's data lives in is reset next tick
+	void carry_prev() noexcept
+	{
+		for(entity_packs_t &packs : entity_data) {
+			for(packed_entity_data_t &data : packs.classes) {
+				if(data.written() || !data.prev) {
+					continue;
+				}
+				const packed_entity_data_t &prev{*data.prev};
+				const std::size_t nPadded{PAD_NUMBER(static_cast<std::size_t>(prev.nBytes), 4)};
+				data.packedData = arenas[current_arena].allocate(nPadded);
+				memcpy(data.packedData, prev.packedData, nPadded);
+				data.nBits = prev.nBits;
+				data.nBytes = prev.nBytes;
+			}
+		}
+	}
 
-	inline explicit operator bool() const noexcept
-	{ return this->get_ptr() != nullptr; }
-};
+	std::size_t entity_index(int edict, unsigned long ref) const noexcept
+	{ return find_entity(edict_tables[current_arena], entity_data, edict, ref); }
 
-template <>
-class thread_var<bool> final : public thread_var_base<bool>
-{
-public:
-	using thread_var_base<bool>::thread_var_base;
-	using thread_var_base<bool>::reset;
+	std::size_t prev_entity_index(int edict, unsigned long ref) const noexcept
+	{ return find_entity(edict_tables[current_arena ^ 1], prev_entity_data, edict, ref); }
 
-	inline thread_var()
-		: thread_var_base<bool>{}
+	std::size_t slot_index(int slot) const noexcept
 	{
+		if(slot < 0 || slot >= ABSOLUTE_PLAYER_LIMIT) {
+			return static_cast<std::size_t>(-1);
+		}
+		return static_cast<std::size_t>(slot_table[static_cast<std::size_t>(slot)]);
 	}
 
-	inline bool operator*() const noexcept
-	{ return get(); }
-
-	inline bool get() const noexcept
+	void clear() noexcept
 	{
-		const bool *ptr{get_ptr_raw()};
-		return (ptr && *ptr);
+		release_shadows();
+		shadows.clear();
+		entity_data.clear();
+		entities.clear();
+		prev_entity_data.clear();
+		prev_entities.clear();
+		slots.clear();
+		slot_table.fill(-1);
+		edict_tables[0].fill(-1);
+		edict_tables[1].fill(-1);
+		arenas[0].clear();
+		arenas[1].clear();
 	}
 
-	inline operator bool() const noexcept
-	{ return get(); }
+private:
+	using edict_table_t = std::array<int, MAX_EDICTS>;
 
-	bool reset(bool val) noexcept
+	static std::size_t find_entity(const edict_table_t &table, const std::vector<entity_packs_t> &data, int edict, unsigned long ref) noexcept
 	{
-		set_value(val);
-		return val;
+		if(edict < 0 || edict >= MAX_EDICTS) {
+			return static_cast<std::size_t>(-1);
+		}
+		const int idx{table[static_cast<std::size_t>(edict)]};
+		//the edict could have been reused by another entity
+		if(idx == -1 || data[static_cast<std::size_t>(idx)].ref != ref) {
+			return static_cast<std::size_t>(-1);
+		}
+		return static_cast<std::size_t>(idx);
 	}
 
-	thread_var &operator=(std::nullptr_t) noexcept
-	{
-		set_value(false);
-		return *this;
-	}
+	packed_data_arena_t arenas[2]{};
+	edict_table_t edict_tables[2];
+	std::size_t current_arena{0};
+	std::array<int, ABSOLUTE_PLAYER_LIMIT> slot_table;
+
+	std::vector<std::unique_ptr<packed_entity_shadow_t>> shadows{};
+	std::size_t shadows_used{0};
+	std::mutex shadows_mtx{};
+
+	pack_entity_params_t(const pack_entity_params_t &) = delete;
+	pack_entity_params_t &operator=(const pack_entity_params_t &) = delete;
+	pack_entity_params_t(pack_entity_params_t &&) = delete;
+	pack_entity_params_t &operator=(pack_entity_params_t &&) = delete;
+};
+
+//the encode, calcdelta and getpackedentity detours stay installed and these decide if they do anything
+static std::atomic<bool> in_compute_packs{false};
+static std::atomic<bool> hook_results_ready{false};
+static std::atomic<bool> do_writedelta_entities{false};
 
-	inline thread_var(bool val) noexcept
-	{ set_value(val); }
+//reused between calls so merging the per-client deltas is linear and allocation free
+struct calcdelta_scratch_t final
+{
+	std::vector<int> props{};
+	std::vector<bool> seen{};
 
-	thread_var &operator=(bool val) noexcept
+	void prepare(int nMaxDeltaProps) noexcept
 	{
-		set_value(val);
-		return *this;
+		const std::size_t size{static_cast<std::size_t>(nMaxDeltaProps)};
+		if(props.size() < size) {
+			props.resize(size);
+		}
+		if(seen.size() < size) {
+			seen.resize(size, false);
+		}
 	}
 
-private:
-	void set_value(bool val) noexcept
+	bool test_and_set(int prop) noexcept
 	{
-		*this->get_or_allocate_ptr() = val;
+		const std::size_t idx{static_cast<std::size_t>(prop)};
+		if(idx >= seen.size()) {
+			seen.resize(idx+1, false);
+		}
+		const bool was_set{seen[idx]};
+		seen[idx] = true;
+		return was_set;
 	}
+
+	void clear(int prop) noexcept
+	{ seen[static_cast<std::size_t>(prop)] = false; }
 };
 
-CBaseEntity *ReferenceToEntity(unsigned long ref)
+//what string callbacks write into, per thread so evaluating strings never shares a buffer
+struct string_scratch_t final
 {
-	union {
-		cell_t sp_val;
-		unsigned long e_val;
-	} u;
-
-	u.e_val = ref;
-
-	return gamehelpers->ReferenceToEntity(u.sp_val);
-}
+	char value[4096];
+};
 
-unsigned long EntityToReference(CBaseEntity *ent)
+//the state every proxy and detour call reads, reached with a single tls access
+//trivial so the thread_local is constant initialized and never goes through a tls init guard
+struct pack_context_t final
 {
-	union {
-		cell_t sp_val;
-		unsigned long e_val;
-	} u;
+	bool do_calc_delta;
+	int writedeltaentities_client;
+	int sendproxy_client_slot;
+};
 
-	u.sp_val = gamehelpers->EntityToReference(ent);
+static_assert(std::is_trivial<pack_context_t>::value, "pack_context_t must stay trivial");
 
-	return u.e_val;
-}
+static thread_local pack_context_t pack_context{false, -1, -1};
 
-unsigned long IndexToReference(int objectID)
+//kept alive between ticks so the arena can be reused, packentity_params is only set while it is in use
+static std::unique_ptr<pack_entity_params_t> packentity_params_storage{};
+static pack_entity_params_t *packentity_params{nullptr};
+
+static void Host_Error(const char *error, ...) noexcept
 {
-	union {
-		cell_t sp_val;
-		unsigned long e_val;
-	} u;
+	va_list argptr;
+	char string[1024];
 
-	u.sp_val = gamehelpers->IndexToReference(objectID);
+	va_start(argptr, error);
+	Q_vsnprintf(string, sizeof(string), error, argptr);
+	va_end(argptr);
 
-	return u.e_val;
+	Error("Host_Error: %s", string);
 }
 
-struct packed_entity_data_t final
+struct prop_reference_t
 {
-	packed_entity_data_t(packed_entity_data_t &&other) noexcept
-	{ operator=(std::move(other)); }
-	packed_entity_data_t &operator=(packed_entity_data_t &&other) noexcept {
-		packedData = other.packedData;
-		other.packedData = nullptr;
-		writeBuf = other.writeBuf;
-		other.writeBuf = nullptr;
-		ref = other.ref;
-		other.ref = INVALID_EHANDLE_INDEX;
-		return *this;
-	}
-
-	char *packedData{nullptr};
-	bf_write *writeBuf{nullptr};
-	unsigned long ref{INVALID_EHANDLE_INDEX};
-
-	bool allocated() const noexcept
-	{ return (packedData && writeBuf); }
-
-	bool written() const noexcept
-	{ return allocated() && (writeBuf->GetNumBitsWritten() > 0); }
-
-	packed_entity_data_t() noexcept = default;
-	~packed_entity_data_t() noexcept {
-		reset();
-	}
-
-	void reset() noexcept {
-		if(writeBuf) {
-			delete writeBuf;
-			writeBuf = nullptr;
-		}
-		if(packedData) {
-			free(packedData);
-			packedData = nullptr;
-		}
-	}
-
-	void allocate() noexcept {
-		reset();
-
-		packedData = static_cast<char *>(aligned_alloc(4, MAX_PACKEDENTITY_DATA));
-		memset(packedData, 0x0, MAX_PACKEDENTITY_DATA);
-		writeBuf = new bf_write{"SV_PackEntity->writeBuf", packedData, MAX_PACKEDENTITY_DATA};
-	}
-
-private:
-	packed_entity_data_t(const packed_entity_data_t &) = delete;
-	packed_entity_data_t &operator=(const packed_entity_data_t &) = delete;
-};
-
-struct pack_entity_params_t final
-{
-	std::vector<std::vector<packed_entity_data_t>> entity_data{};
-	std::vector<int> slots{};
-	std::vector<unsigned long> entities{};
-	int snapshot_index{-1};
-
-	pack_entity_params_t(std::vector<int> &&slots_, std::vector<unsigned long> &&entities_, int snapshot_index_) noexcept
-		: slots{std::move(slots_)}, entities{std::move(entities_)}, snapshot_index{snapshot_index_}
-	{
-		entity_data.resize(slots.size());
-	}
-	~pack_entity_params_t() noexcept = default;
-
-private:
-	pack_entity_params_t(const pack_entity_params_t &) = delete;
-	pack_entity_params_t &operator=(const pack_entity_params_t &) = delete;
-	pack_entity_params_t(pack_entity_params_t &&) = delete;
-	pack_entity_params_t &operator=(pack_entity_params_t &&) = delete;
-};
-
-static thread_var<bool> in_compute_packs{};
-static thread_var<bool> do_calc_delta{};
-static thread_var<bool> do_writedelta_entities{};
-static thread_var<int> writedeltaentities_client{};
-static thread_var<int> sendproxy_client_slot{};
-
-static std::unique_ptr<pack_entity_params_t> packentity_params{};
-
-static void Host_Error(const char *error, ...) noexcept
-{
-	va_list argptr;
-	char string[1024];
-
-	va_start(argptr, error);
-	Q_vsnprintf(string, sizeof(string), error, argptr);
-	va_end(argptr);
-
-	Error("Host_Error: %s", string);
-}
-
-struct prop_reference_t
-{
-	prop_reference_t(SendProp *pProp, prop_types type) noexcept
-	{
-		restores_t::iterator it_restore{restores.find(pProp)};
-		if(it_restore == restores.end()) {
-			std::unique_ptr<proxyrestore_t> ptr{new proxyrestore_t{pProp, type}};
-			it_restore = restores.emplace(std::pair<SendProp *, std::unique_ptr<proxyrestore_t>>{pProp, std::move(ptr)}).first;
-		}
-		restore = it_restore->second.get();
-		++restore->ref;
-	#ifdef _DEBUG
-		printf("added ref %zu for %s %p\n", restore->ref, pProp->GetName(), pProp);
-	#endif
+	prop_reference_t(SendProp *pProp, prop_types type) noexcept
+	{
+		restores_t::iterator it_restore{restores.find(pProp)};
+		if(it_restore == restores.end()) {
+			std::unique_ptr<proxyrestore_t> ptr{new proxyrestore_t{pProp, type, alloc_restore_index()}};
+			it_restore = restores.emplace(std::pair<SendProp *, std::unique_ptr<proxyrestore_t>>{pProp, std::move(ptr)}).first;
+			add_restore_lookup(it_restore->second.get());
+		}
+		restore = it_restore->second.get();
+		++restore->ref;
+	#ifdef _DEBUG
+		printf("added ref %zu for %s %p\n", restore->ref, pProp->GetName(), pProp);
+	#endif
 	}
 
 	virtual ~prop_reference_t() noexcept
@@ -806,6 +1000,7 @@ struct prop_reference_t
 			printf("removed ref %zu for %s %p\n", restore->ref-1u, restore->pProp->GetName(), restore->pProp);
 		#endif
 			if(--restore->ref == 0) {
+				remove_restore_lookup(restore);
 				restores_t::iterator it_restore{restores.begin()};
 				while(it_restore != restores.end()) {
 					if(it_restore->second.get() == restore) {
@@ -850,13 +1045,19 @@ struct opaque_ptr final
 	static void del_hlpr(void *ptr_) noexcept
 	{ delete static_cast<T *>(ptr_); }
 
+	//single values of every prop type except strings fit here, they never touch the heap
+	static constexpr std::size_t inline_size{16};
+
+	template <typename T>
+	struct fits_inline : std::integral_constant<bool, (sizeof(T) <= inline_size && alignof(T) <= alignof(double) && std::is_trivially_destructible<T>::value)>
+	{
+	};
+
 	opaque_ptr() = default;
 
 	template <typename T, typename ...Args>
 	void emplace(std::size_t num, Args &&...args) noexcept {
-		if(del_func && ptr) {
-			del_func(ptr);
-		}
+		clear();
 		if(num > 1) {
 			ptr = static_cast<void *>(new T[num]);
 			for(size_t i = 0; i < num; ++i) {
@@ -864,11 +1065,27 @@ struct opaque_ptr final
 			}
 			del_func = del_hlpr_arr<T>;
 		} else {
-			ptr = static_cast<void *>(new T{std::forward<Args>(args)...});
-			del_func = del_hlpr<T>;
+			emplace_one<T>(fits_inline<T>{}, std::forward<Args>(args)...);
 		}
 	}
 
+	//strings are copied into a buffer that keeps its capacity after clear
+	//so a result that changes every tick stops allocating once it has seen its longest value
+	const char *assign_string(const char *str) noexcept
+	{
+		clear();
+		copy_string(str);
+		ptr = static_cast<void *>(string_buffer.data());
+		return string_buffer.data();
+	}
+
+	void assign_tstring(const char *str) noexcept
+	{
+		clear();
+		copy_string(str);
+		emplace_one<string_t>(std::true_type{}, MAKE_STRING(string_buffer.data()));
+	}
+
 	void clear() noexcept {
 		if(del_func && ptr) {
 			del_func(ptr);
@@ -899,9 +1116,24 @@ struct opaque_ptr final
 
 	opaque_ptr &operator=(opaque_ptr &&other) noexcept
 	{
-		ptr = other.ptr;
+		if(this == &other) {
+			return *this;
+		}
+		clear();
+		//swapped vectors keep their data so string_t values stored inline stay valid
+		//and other keeps the old buffer, a reused scratch value won't need to grow it again
+		string_buffer.swap(other.string_buffer);
+		if(other.ptr == other.storage) {
+			//inline values are trivially destructible so their bytes can just be moved over
+			memcpy(storage, other.storage, inline_size);
+			ptr = storage;
+		} else if(other.ptr && other.ptr == static_cast<void *>(string_buffer.data())) {
+			ptr = other.ptr;
+		} else {
+			ptr = other.ptr;
+			del_func = other.del_func;
+		}
 		other.ptr = nullptr;
-		del_func = other.del_func;
 		other.del_func = nullptr;
 		return *this;
 	}
@@ -910,48 +1142,287 @@ private:
 	opaque_ptr(const opaque_ptr &) = delete;
 	opaque_ptr &operator=(const opaque_ptr &) = delete;
 
+	void copy_string(const char *str) noexcept
+	{
+		const std::size_t len{strlen(str)+1};
+		string_buffer.resize(len);
+		memcpy(string_buffer.data(), str, len);
+	}
+
+	template <typename T, typename ...Args>
+	void emplace_one(std::true_type, Args &&...args) noexcept
+	{ ptr = static_cast<void *>(new (storage) T{std::forward<Args>(args)...}); }
+
+	template <typename T, typename ...Args>
+	void emplace_one(std::false_type, Args &&...args) noexcept
+	{
+		ptr = static_cast<void *>(new T{std::forward<Args>(args)...});
+		del_func = del_hlpr<T>;
+	}
+
 	void *ptr{nullptr};
 	void (*del_func)(void *) {nullptr};
+	alignas(double) unsigned char storage[inline_size];
+	std::vector<char> string_buffer{};
 };
 
-struct callback_t final : prop_reference_t
+//buffers only merging deltas and evaluating callbacks need, kept out of pack_context
+//so the hot fields don't pay for their dynamic initialization
+struct pack_scratch_t final
+{
+	calcdelta_scratch_t calcdelta{};
+	string_scratch_t string{};
+	//chained callbacks read the previous result so they write into this instead
+	opaque_ptr chained_value{};
+	//arrays handed to batch callbacks
+	std::vector<cell_t> batch_clients{};
+	std::vector<cell_t> batch_values{};
+	std::vector<cell_t> batch_old_values{};
+};
+
+static thread_local pack_scratch_t pack_scratch{};
+
+//a value handed to us by another extension or a plugin before the type of the prop is known
+struct client_value_t final
 {
-	callback_t(unsigned long ref_, SendProp *pProp, std::string &&name_, int element_, prop_types type_, std::size_t offset_) noexcept
-		: prop_reference_t{pProp, type_}, offset{offset_}, type{type_}, element{element_}, name{std::move(name_)}, prop{pProp}, ref{ref_}
+	enum class kind_t : unsigned char
 	{
-		if(type == prop_types::cstring || type == prop_types::tstring) {
-			fwd = forwards->CreateForwardEx(nullptr, ET_Hook, 6, nullptr, Param_Cell, Param_String, Param_String, Param_Cell, Param_Cell, Param_Cell);
-		} else if(type == prop_types::color32_) {
-			fwd = forwards->CreateForwardEx(nullptr, ET_Hook, 8, nullptr, Param_Cell, Param_String, Param_CellByRef, Param_CellByRef, Param_CellByRef, Param_CellByRef, Param_Cell, Param_Cell);
-		} else {
-			ParamType value_param_type;
+		int_,
+		float_,
+		vector,
+		string
+	};
 
-			switch(type) {
-				case prop_types::int_:
-				case prop_types::short_:
-				case prop_types::char_:
-				case prop_types::unsigned_int:
-				case prop_types::unsigned_short:
-				case prop_types::unsigned_char:
-				case prop_types::bool_:
-				case prop_types::ehandle: {
-					value_param_type = Param_CellByRef;
-				} break;
-				case prop_types::float_: {
-					value_param_type = Param_FloatByRef;
-				} break;
-				case prop_types::vector:
-				case prop_types::qangle: {
-					value_param_type = Param_Array;
-				} break;
+	kind_t kind{kind_t::int_};
+	cell_t i{0};
+	float f{0.0f};
+	float vec[3]{0.0f, 0.0f, 0.0f};
+	std::string str{};
+};
+
+enum class forward_signature_t : unsigned char
+{
+	cell,
+	float_,
+	array,
+	color32_,
+	string,
+	batch,
+	unknown
+};
+
+//callbacks with the same functions and parameters share one forward
+//so hooking the same prop on every player doesn't create a forward for each of them
+class forward_pool_t final
+{
+public:
+	using functions_t = std::vector<IPluginFunction *>;
+	using key_t = std::pair<forward_signature_t, functions_t>;
+
+	//callbacks keep a pointer to this instead of their own copy of the function list
+	struct entry_t final
+	{
+		IChangeableForward *fwd{nullptr};
+		std::size_t refs{0};
+		//owned by the pool, the key this entry was acquired with
+		const key_t *key{nullptr};
+	};
+
+	forward_pool_t() noexcept = default;
+	~forward_pool_t() noexcept = default;
+
+	const entry_t *acquire(forward_signature_t signature, const functions_t &funcs) noexcept
+	{
+		if(funcs.empty()) {
+			return nullptr;
+		}
+
+		key_t key{signature, funcs};
+		pool_t::iterator it_fwd{pool.find(key)};
+		if(it_fwd == pool.end()) {
+			IChangeableForward *fwd{create(signature)};
+			for(IPluginFunction *func : funcs) {
+				fwd->AddFunction(func);
 			}
+			it_fwd = pool.emplace(std::move(key), entry_t{fwd}).first;
+			it_fwd->second.key = &it_fwd->first;
+		}
+
+		++it_fwd->second.refs;
+		return &it_fwd->second;
+	}
+
+	void release(const entry_t *entry) noexcept
+	{
+		pool_t::iterator it_fwd{pool.find(*entry->key)};
+		if(it_fwd == pool.end()) {
+			return;
+		}
+
+		if(--it_fwd->second.refs == 0) {
+			forwards->ReleaseForward(it_fwd->second.fwd);
+			pool.erase(it_fwd);
+		}
+	}
+
+	static const functions_t &functions(const entry_t *entry) noexcept
+	{
+		static const functions_t empty{};
+		return (entry ? entry->key->second : empty);
+	}
+
+private:
+	static IChangeableForward *create(forward_signature_t signature) noexcept
+	{
+		switch(signature) {
+			case forward_signature_t::string:
+			return forwards->CreateForwardEx(nullptr, ET_Hook, 6, nullptr, Param_Cell, Param_String, Param_String, Param_Cell, Param_Cell, Param_Cell);
+			case forward_signature_t::color32_:
+			return forwards->CreateForwardEx(nullptr, ET_Hook, 8, nullptr, Param_Cell, Param_String, Param_CellByRef, Param_CellByRef, Param_CellByRef, Param_CellByRef, Param_Cell, Param_Cell);
+			case forward_signature_t::batch:
+			return forwards->CreateForwardEx(nullptr, ET_Hook, 6, nullptr, Param_Cell, Param_String, Param_Array, Param_Array, Param_Cell, Param_Cell);
+			case forward_signature_t::float_:
+			return forwards->CreateForwardEx(nullptr, ET_Hook, 5, nullptr, Param_Cell, Param_String, Param_FloatByRef, Param_Cell, Param_Cell);
+			case forward_signature_t::array:
+			return forwards->CreateForwardEx(nullptr, ET_Hook, 5, nullptr, Param_Cell, Param_String, Param_Array, Param_Cell, Param_Cell);
+			default:
+			return forwards->CreateForwardEx(nullptr, ET_Hook, 5, nullptr, Param_Cell, Param_String, Param_CellByRef, Param_Cell, Param_Cell);
+		}
+	}
+
+	using pool_t = std::map<key_t, entry_t>;
+	pool_t pool{};
+
+	forward_pool_t(const forward_pool_t &) = delete;
+	forward_pool_t &operator=(const forward_pool_t &) = delete;
+	forward_pool_t(forward_pool_t &&) = delete;
+	forward_pool_t &operator=(forward_pool_t &&) = delete;
+};
+
+static forward_pool_t forward_pool{};
+
+//entities and classes with anything per-client, callback_t keeps these up to date
+//so SV_ComputeClientPacks only looks for per-client results where there can be any
+static std::array<unsigned int, MAX_EDICTS> per_client_callbacks{};
+static std::bitset<MAX_EDICTS> per_client_edicts;
+static std::unordered_map<const ServerClass *, std::size_t> per_client_classes;
+
+static void change_per_client_count(int edict, const ServerClass *pServer, bool add) noexcept
+{
+	if(pServer) {
+		std::size_t &count{per_client_classes[pServer]};
+		if(add) {
+			++count;
+		} else if(--count == 0) {
+			per_client_classes.erase(pServer);
+		}
+		return;
+	}
+
+	if(edict < 0 || edict >= MAX_EDICTS) {
+		return;
+	}
+
+	unsigned int &count{per_client_callbacks[static_cast<std::size_t>(edict)]};
+	if(add) {
+		++count;
+	} else {
+		--count;
+	}
+	per_client_edicts.set(static_cast<std::size_t>(edict), count > 0);
+}
+
+static inline bool is_class_per_client(const ServerClass *pServer) noexcept
+{ return (per_client_classes.find(pServer) != per_client_classes.cend()); }
+
+//callback output of the current tick for one client
+struct callback_result_t final
+{
+	bool changed{false};
+	opaque_ptr value{};
+};
+
+//kept apart from callback_t so class hooks can keep one per entity without an entity callback
+struct callback_results_t final
+{
+	//0 is the global value and the rest are indexed by client
+	std::vector<callback_result_t> current{};
+	std::vector<callback_result_t> prev{};
+	//if anything per-client ran for these, set on every evaluate
+	bool per_client{false};
+	//entity the results belong to so class hooks can tell when an edict is reused
+	unsigned long ref{INVALID_EHANDLE_INDEX};
+};
+
+struct callback_t final : prop_reference_t
+{
+	callback_t(unsigned long ref_, const ServerClass *server_class_, SendProp *pProp, const char *name_, int element_, prop_types type_, std::size_t offset_) noexcept
+		: prop_reference_t{pProp, type_}, offset{offset_}, type{type_}, element{element_}, name{name_}, prop{pProp}, ref{ref_}, edict{ref_ != INVALID_EHANDLE_INDEX ? ::ReferenceToIndex(ref_) : -1}, server_class{server_class_}, fwd_caller{get_fwd_caller(type_)}, value_compare{get_value_compare(type_)}
+	{
+	}
 
-			fwd = forwards->CreateForwardEx(nullptr, ET_Hook, 5, nullptr, Param_Cell, Param_String, value_param_type, Param_Cell, Param_Cell);
+	static forward_signature_t forward_signature(prop_types type) noexcept
+	{
+		switch(type) {
+			case prop_types::int_:
+			case prop_types::short_:
+			case prop_types::char_:
+			case prop_types::unsigned_int:
+			case prop_types::unsigned_short:
+			case prop_types::unsigned_char:
+			case prop_types::bool_:
+			case prop_types::ehandle:
+			return forward_signature_t::cell;
+			case prop_types::float_:
+			return forward_signature_t::float_;
+			case prop_types::vector:
+			case prop_types::qangle:
+			return forward_signature_t::array;
+			case prop_types::color32_:
+			return forward_signature_t::color32_;
+			case prop_types::cstring:
+			case prop_types::tstring:
+			return forward_signature_t::string;
+			default:
+			return forward_signature_t::unknown;
 		}
 	}
 
 	inline bool has_any_per_client_func() const noexcept
-	{ return !per_client_funcs.empty(); }
+	{
+		return (!per_client_funcs.empty() ||
+			batch_entry ||
+			!override_callbacks.empty() ||
+			overrides_count > 0);
+	}
+
+	//overrides count too so a callback with only static values is kept around
+	std::size_t function_count() const noexcept
+	{
+		std::size_t count{forward_pool_t::functions(fwd_entry).size() + forward_pool_t::functions(batch_entry).size()};
+		count += override_callbacks.size();
+		count += overrides_count;
+		return count;
+	}
+
+	//batch callbacks get every client at once so the value must fit in a cell
+	static bool supports_batch(prop_types type) noexcept
+	{
+		switch(type) {
+			case prop_types::int_:
+			case prop_types::short_:
+			case prop_types::char_:
+			case prop_types::unsigned_int:
+			case prop_types::unsigned_short:
+			case prop_types::unsigned_char:
+			case prop_types::bool_:
+			case prop_types::float_:
+			case prop_types::ehandle:
+			return true;
+			default:
+			return false;
+		}
+	}
 
 	void change_edict_state() noexcept
 	{
@@ -968,8 +1439,10 @@ struct callback_t final : prop_reference_t
 
 	void add_function(IPluginFunction *func, bool per_client) noexcept
 	{
-		fwd->RemoveFunction(func);
-		fwd->AddFunction(func);
+		forward_pool_t::functions_t new_funcs{forward_pool_t::functions(fwd_entry)};
+		new_funcs.erase(std::remove(new_funcs.begin(), new_funcs.end(), func), new_funcs.end());
+		new_funcs.emplace_back(func);
+		set_functions(forward_signature(type), fwd_entry, std::move(new_funcs));
 
 		if(per_client) {
 			bool found{false};
@@ -987,11 +1460,51 @@ struct callback_t final : prop_reference_t
 				per_client_funcs.emplace_back(per_client_func_t{func});
 			}
 		}
+
+		update_per_client();
+	}
+
+	void add_batch_function(IPluginFunction *func) noexcept
+	{
+		forward_pool_t::functions_t new_funcs{forward_pool_t::functions(batch_entry)};
+		new_funcs.erase(std::remove(new_funcs.begin(), new_funcs.end(), func), new_funcs.end());
+		new_funcs.emplace_back(func);
+		set_functions(forward_signature_t::batch, batch_entry, std::move(new_funcs));
+
+		update_per_client();
+	}
+
+	//forwards are never modified in place since other callbacks can be using the same one
+	static void set_functions(forward_signature_t signature, const forward_pool_t::entry_t *&entry, forward_pool_t::functions_t &&new_funcs) noexcept
+	{
+		if(new_funcs == forward_pool_t::functions(entry)) {
+			return;
+		}
+
+		const forward_pool_t::entry_t *new_entry{forward_pool.acquire(signature, new_funcs)};
+		if(entry) {
+			forward_pool.release(entry);
+		}
+		entry = new_entry;
+	}
+
+	template <typename F>
+	static void remove_functions_if(forward_signature_t signature, const forward_pool_t::entry_t *&entry, F &&pred) noexcept
+	{
+		forward_pool_t::functions_t new_funcs{forward_pool_t::functions(entry)};
+		new_funcs.erase(std::remove_if(new_funcs.begin(), new_funcs.end(), std::forward<F>(pred)), new_funcs.end());
+		set_functions(signature, entry, std::move(new_funcs));
 	}
 
 	void remove_function(IPluginFunction *func) noexcept
 	{
-		fwd->RemoveFunction(func);
+		const auto is_func{
+			[func](IPluginFunction *other) noexcept -> bool {
+				return (other == func);
+			}
+		};
+		remove_functions_if(forward_signature(type), fwd_entry, is_func);
+		remove_functions_if(forward_signature_t::batch, batch_entry, is_func);
 
 		per_client_funcs_t::const_iterator it_func{per_client_funcs.cbegin()};
 		while(it_func != per_client_funcs.cend()) {
@@ -1001,6 +1514,8 @@ struct callback_t final : prop_reference_t
 			}
 			++it_func;
 		}
+
+		update_per_client();
 	}
 
 	void remove_functions_of_plugin(IPlugin *plugin) noexcept
@@ -1014,22 +1529,33 @@ struct callback_t final : prop_reference_t
 			++it_func;
 		}
 
-		fwd->RemoveFunctionsOfPlugin(plugin);
+		IPluginContext *context{plugin->GetBaseContext()};
+		const auto is_plugin_func{
+			[context](IPluginFunction *func) noexcept -> bool {
+				return (func->GetParentContext() == context);
+			}
+		};
+		remove_functions_if(forward_signature(type), fwd_entry, is_plugin_func);
+		remove_functions_if(forward_signature_t::batch, batch_entry, is_plugin_func);
+
+		update_per_client();
 	}
 
 	~callback_t() noexcept override final {
-		if(fwd) {
-			forwards->ReleaseForward(fwd);
+		if(tracked_per_client) {
+			change_per_client_count(edict, server_class, false);
+		}
+		if(fwd_entry) {
+			forward_pool.release(fwd_entry);
+		}
+		if(batch_entry) {
+			forward_pool.release(batch_entry);
 		}
 	}
 
 	static int get_current_client_slot() noexcept
 	{
-		if(!sendproxy_client_slot) {
-			return -1;
-		}
-
-		return sendproxy_client_slot;
+		return pack_context.sendproxy_client_slot;
 	}
 
 	static int get_current_client_entity() noexcept
@@ -1044,8 +1570,9 @@ struct callback_t final : prop_reference_t
 
 	bool fwd_call_ehandle(int client, const SendProp *pProp, const void *old_pData, opaque_ptr &new_pData, int objectID) const noexcept
 	{
+		IChangeableForward *fwd{fwd_entry->fwd};
 		fwd->PushCell(objectID);
-		fwd->PushStringEx((char *)name.c_str(), name.size()+1, SM_PARAM_STRING_COPY|SM_PARAM_STRING_UTF8, 0);
+		fwd->PushStringEx((char *)name, strlen(name)+1, SM_PARAM_STRING_COPY|SM_PARAM_STRING_UTF8, 0);
 		const EHANDLE &hndl{*reinterpret_cast<const EHANDLE *>(old_pData)};
 		CBaseEntity *pEntity = hndl.Get();
 		cell_t sp_value{pEntity ? gamehelpers->EntityToBCompatRef(pEntity) : -1};
@@ -1070,8 +1597,9 @@ struct callback_t final : prop_reference_t
 
 	bool fwd_call_color32(int client, const SendProp *pProp, const void *old_pData, opaque_ptr &new_pData, int objectID) const noexcept
 	{
+		IChangeableForward *fwd{fwd_entry->fwd};
 		fwd->PushCell(objectID);
-		fwd->PushStringEx((char *)name.c_str(), name.size()+1, SM_PARAM_STRING_COPY|SM_PARAM_STRING_UTF8, 0);
+		fwd->PushStringEx((char *)name, strlen(name)+1, SM_PARAM_STRING_COPY|SM_PARAM_STRING_UTF8, 0);
 		const color32 &clr{*reinterpret_cast<const color32 *>(old_pData)};
 		cell_t sp_r{static_cast<cell_t>(clr.r)};
 		cell_t sp_g{static_cast<cell_t>(clr.g)};
@@ -1100,8 +1628,9 @@ struct callback_t final : prop_reference_t
 	template <typename T>
 	bool fwd_call_int(int client, const SendProp *pProp, const void *old_pData, opaque_ptr &new_pData, int objectID) const noexcept
 	{
+		IChangeableForward *fwd{fwd_entry->fwd};
 		fwd->PushCell(objectID);
-		fwd->PushStringEx((char *)name.c_str(), name.size()+1, SM_PARAM_STRING_COPY|SM_PARAM_STRING_UTF8, 0);
+		fwd->PushStringEx((char *)name, strlen(name)+1, SM_PARAM_STRING_COPY|SM_PARAM_STRING_UTF8, 0);
 		cell_t sp_value{static_cast<cell_t>(*reinterpret_cast<const T *>(old_pData))};
 		fwd->PushCellByRef(&sp_value);
 		fwd->PushCell(element);
@@ -1119,8 +1648,9 @@ struct callback_t final : prop_reference_t
 
 	bool fwd_call_float(int client, const SendProp *pProp, const void *old_pData, opaque_ptr &new_pData, int objectID) const noexcept
 	{
+		IChangeableForward *fwd{fwd_entry->fwd};
 		fwd->PushCell(objectID);
-		fwd->PushStringEx((char *)name.c_str(), name.size()+1, SM_PARAM_STRING_COPY|SM_PARAM_STRING_UTF8, 0);
+		fwd->PushStringEx((char *)name, strlen(name)+1, SM_PARAM_STRING_COPY|SM_PARAM_STRING_UTF8, 0);
 		float sp_value{static_cast<float>(*reinterpret_cast<const float *>(old_pData))};
 		fwd->PushFloatByRef(&sp_value);
 		fwd->PushCell(element);
@@ -1139,8 +1669,9 @@ struct callback_t final : prop_reference_t
 	template <typename T>
 	bool fwd_call_vec(int client, const SendProp *pProp, const void *old_pData, opaque_ptr &new_pData, int objectID) const noexcept
 	{
+		IChangeableForward *fwd{fwd_entry->fwd};
 		fwd->PushCell(objectID);
-		fwd->PushStringEx((char *)name.c_str(), name.size()+1, SM_PARAM_STRING_COPY|SM_PARAM_STRING_UTF8, 0);
+		fwd->PushStringEx((char *)name, strlen(name)+1, SM_PARAM_STRING_COPY|SM_PARAM_STRING_UTF8, 0);
 		const T &vec{*reinterpret_cast<const T *>(old_pData)};
 		cell_t sp_value[3]{
 			sp_ftoc(vec[0]),
@@ -1163,95 +1694,653 @@ struct callback_t final : prop_reference_t
 		return false;
 	}
 
-	bool fwd_call_str(int client, const SendProp *pProp, const void *old_pData, opaque_ptr &new_pData, int objectID) const noexcept
+	//plugins write into a per-thread buffer, only strings they actually changed are copied into the result
+	bool fwd_call_string(int client, const char *str, opaque_ptr &new_pData, int objectID, bool tstring) const noexcept
 	{
-		fwd->PushCell(objectID);
-		fwd->PushStringEx((char *)name.c_str(), name.size()+1, SM_PARAM_STRING_COPY|SM_PARAM_STRING_UTF8, 0);
-		static char sp_value[4096];
-		const char *str{reinterpret_cast<const char *>(old_pData)};
-		size_t len{strlen(str)};
-		strcpy(sp_value, str);
-		fwd->PushStringEx(sp_value, len, SM_PARAM_STRING_UTF8|SM_PARAM_STRING_COPY, SM_PARAM_COPYBACK);
-		fwd->PushCell(sizeof(sp_value));
-		fwd->PushCell(element);
-		fwd->PushCell(client);
-		cell_t res{Pl_Continue};
-		fwd->Execute(&res);
-		if(res == Pl_Changed) {
-			new_pData.emplace<char>(strlen(sp_value)+1);
-			char *new_value{new_pData.get<char>()};
-			strcpy(new_value, new_value);
-			return true;
+		IChangeableForward *fwd{fwd_entry->fwd};
+		string_scratch_t &scratch{pack_scratch.string};
+
+		std::size_t len{strlen(str)};
+		if(len >= sizeof(scratch.value)) {
+			len = sizeof(scratch.value)-1;
 		}
-		return false;
-	}
+		memcpy(scratch.value, str, len);
+		scratch.value[len] = '\0';
 
-	bool fwd_call_tstr(int client, const SendProp *pProp, const void *old_pData, opaque_ptr &new_pData, int objectID) const noexcept
-	{
 		fwd->PushCell(objectID);
-		fwd->PushStringEx((char *)name.c_str(), name.size()+1, SM_PARAM_STRING_COPY|SM_PARAM_STRING_UTF8, 0);
-		static char sp_value[4096];
-		const char *str{STRING(*reinterpret_cast<const string_t *>(old_pData))};
-		size_t len{strlen(str)};
-		strcpy(sp_value, str);
-		fwd->PushStringEx(sp_value, len, SM_PARAM_STRING_UTF8|SM_PARAM_STRING_COPY, SM_PARAM_COPYBACK);
-		fwd->PushCell(sizeof(sp_value));
+		fwd->PushStringEx((char *)name, strlen(name)+1, SM_PARAM_STRING_COPY|SM_PARAM_STRING_UTF8, 0);
+		fwd->PushStringEx(scratch.value, len, SM_PARAM_STRING_UTF8|SM_PARAM_STRING_COPY, SM_PARAM_COPYBACK);
+		fwd->PushCell(sizeof(scratch.value));
 		fwd->PushCell(element);
 		fwd->PushCell(client);
 		cell_t res{Pl_Continue};
 		fwd->Execute(&res);
-		if(res == Pl_Changed) {
-			new_pData.emplace<string_t>(1);
-			string_t &new_value{new_pData.get<string_t>(0)};
-			new_value = MAKE_STRING(sp_value);
+		if(res == Pl_Changed && strcmp(scratch.value, str) != 0) {
+			//results can outlive this call so keep our own copy of the string
+			if(tstring) {
+				new_pData.assign_tstring(scratch.value);
+			} else {
+				new_pData.assign_string(scratch.value);
+			}
 			return true;
 		}
 		return false;
 	}
 
-	bool can_call_fwd(int client) const noexcept
-	{
-		if(!fwd || (has_any_per_client_func() && client == -1)) {
-			return false;
-		}
-		return true;
-	}
+	bool fwd_call_str(int client, const SendProp *pProp, const void *old_pData, opaque_ptr &new_pData, int objectID) const noexcept
+	{ return fwd_call_string(client, reinterpret_cast<const char *>(old_pData), new_pData, objectID, false); }
 
-	bool fwd_call(int client, const SendProp *pProp, const void *old_pData, opaque_ptr &new_pData, int objectID) const noexcept
-	{
-		switch(type) {
-			case prop_types::int_:
-			return fwd_call_int<int>(client, pProp, old_pData, new_pData, objectID);
+	bool fwd_call_tstr(int client, const SendProp *pProp, const void *old_pData, opaque_ptr &new_pData, int objectID) const noexcept
+	{ return fwd_call_string(client, STRING(*reinterpret_cast<const string_t *>(old_pData)), new_pData, objectID, true); }
+
+	using fwd_call_t = bool (callback_t::*)(int, const SendProp *, const void *, opaque_ptr &, int) const;
+	using same_value_t = bool (*)(const void *, const void *);
+
+	inline bool fwd_call(int client, const SendProp *pProp, const void *old_pData, opaque_ptr &new_pData, int objectID) const noexcept
+	{ return (this->*fwd_caller)(client, pProp, old_pData, new_pData, objectID); }
+
+	//resolved once when the callback is created instead of on every call
+	static fwd_call_t get_fwd_caller(prop_types type) noexcept
+	{
+		switch(type) {
+			case prop_types::int_:
+			return &callback_t::fwd_call_int<int>;
 			case prop_types::bool_:
-			return fwd_call_int<bool>(client, pProp, old_pData, new_pData, objectID);
+			return &callback_t::fwd_call_int<bool>;
 			case prop_types::short_:
-			return fwd_call_int<short>(client, pProp, old_pData, new_pData, objectID);
+			return &callback_t::fwd_call_int<short>;
 			case prop_types::char_:
-			return fwd_call_int<char>(client, pProp, old_pData, new_pData, objectID);
+			return &callback_t::fwd_call_int<char>;
 			case prop_types::unsigned_int:
-			return fwd_call_int<unsigned int>(client, pProp, old_pData, new_pData, objectID);
+			return &callback_t::fwd_call_int<unsigned int>;
 			case prop_types::unsigned_short:
-			return fwd_call_int<unsigned short>(client, pProp, old_pData, new_pData, objectID);
+			return &callback_t::fwd_call_int<unsigned short>;
 			case prop_types::unsigned_char:
-			return fwd_call_int<unsigned char>(client, pProp, old_pData, new_pData, objectID);
+			return &callback_t::fwd_call_int<unsigned char>;
 			case prop_types::float_:
-			return fwd_call_float(client, pProp, old_pData, new_pData, objectID);
+			return &callback_t::fwd_call_float;
 			case prop_types::vector:
-			return fwd_call_vec<Vector>(client, pProp, old_pData, new_pData, objectID);
+			return &callback_t::fwd_call_vec<Vector>;
 			case prop_types::qangle:
-			return fwd_call_vec<QAngle>(client, pProp, old_pData, new_pData, objectID);
+			return &callback_t::fwd_call_vec<QAngle>;
 			case prop_types::color32_:
-			return fwd_call_color32(client, pProp, old_pData, new_pData, objectID);
+			return &callback_t::fwd_call_color32;
 			case prop_types::ehandle:
-			return fwd_call_ehandle(client, pProp, old_pData, new_pData, objectID);
+			return &callback_t::fwd_call_ehandle;
 			case prop_types::cstring:
-			return fwd_call_str(client, pProp, old_pData, new_pData, objectID);
+			return &callback_t::fwd_call_str;
 			case prop_types::tstring:
-			return fwd_call_tstr(client, pProp, old_pData, new_pData, objectID);
+			return &callback_t::fwd_call_tstr;
+		}
+		return &callback_t::fwd_call_nop;
+	}
+
+	bool fwd_call_nop(int, const SendProp *, const void *, opaque_ptr &, int) const noexcept
+	{ return false; }
+
+	//class_callback is the class hook of the same prop, its functions run after the ones of this callback
+	void evaluate(callback_results_t &out, const callback_t *class_callback, const void *pData, int objectID, const std::vector<int> &slots) noexcept
+	{
+		//keep last tick's results around so results_changed can tell if a repack is needed
+		std::swap(out.current, out.prev);
+
+		out.per_client = (has_any_per_client_func() || (class_callback && class_callback->has_any_per_client_func()));
+
+		//only the global value is needed when nothing is per-client
+		const std::size_t results_size{out.per_client ? static_cast<std::size_t>(playerhelpers->GetMaxClients()+1) : 1};
+		out.current.resize(results_size);
+
+		for(callback_result_t &result : out.current) {
+			if(result.changed) {
+				result.value.clear();
+				result.changed = false;
+			}
+		}
+
+		evaluate_functions(out, *this, pData, objectID, slots);
+		if(class_callback) {
+			evaluate_functions(out, *class_callback, pData, objectID, slots);
+		}
+
+		if(out.per_client) {
+			if(batch_entry) {
+				fwd_call_batch(out, pData, objectID, slots);
+			}
+			if(!override_callbacks.empty()) {
+				call_override_callbacks(out, pData, objectID, slots);
+			}
+		}
+	}
+
+	//runs the forward of src, this callback or its class hook, on top of the current results
+	void evaluate_functions(callback_results_t &out, const callback_t &src, const void *pData, int objectID, const std::vector<int> &slots) noexcept
+	{
+		if(!src.fwd_entry) {
+			return;
+		}
+
+		if(out.per_client) {
+			for(int slot : slots) {
+				const int client{slot+1};
+				evaluate_result(out.current[static_cast<std::size_t>(client)], src, client, pData, objectID);
+			}
+		} else {
+			evaluate_result(out.current[0], src, -1, pData, objectID);
+		}
+	}
+
+	void evaluate_result(callback_result_t &result, const callback_t &src, int client, const void *pData, int objectID) noexcept
+	{
+		if(!result.changed) {
+			result.changed = src.fwd_call(client, prop, pData, result.value, objectID);
+			return;
+		}
+
+		//the previous result is the input so the call can't write into it directly
+		opaque_ptr &new_value{pack_scratch.chained_value};
+		if(src.fwd_call(client, prop, result.value.get(), new_value, objectID)) {
+			result.value = std::move(new_value);
+		}
+	}
+
+	cell_t value_to_cell(const void *pData) const noexcept
+	{
+		switch(type) {
+			case prop_types::int_:
+			return static_cast<cell_t>(*static_cast<const int *>(pData));
+			case prop_types::short_:
+			return static_cast<cell_t>(*static_cast<const short *>(pData));
+			case prop_types::char_:
+			return static_cast<cell_t>(*static_cast<const char *>(pData));
+			case prop_types::unsigned_int:
+			return static_cast<cell_t>(*static_cast<const unsigned int *>(pData));
+			case prop_types::unsigned_short:
+			return static_cast<cell_t>(*static_cast<const unsigned short *>(pData));
+			case prop_types::unsigned_char:
+			return static_cast<cell_t>(*static_cast<const unsigned char *>(pData));
+			case prop_types::bool_:
+			return static_cast<cell_t>(*static_cast<const bool *>(pData));
+			case prop_types::float_:
+			return sp_ftoc(*static_cast<const float *>(pData));
+			case prop_types::ehandle: {
+				CBaseEntity *pEntity{static_cast<const EHANDLE *>(pData)->Get()};
+				return (pEntity ? gamehelpers->EntityToBCompatRef(pEntity) : -1);
+			}
+			case prop_types::color32_: {
+				const color32 &clr{*static_cast<const color32 *>(pData)};
+				return static_cast<cell_t>(static_cast<unsigned int>(clr.r) |
+					(static_cast<unsigned int>(clr.g) << 8) |
+					(static_cast<unsigned int>(clr.b) << 16) |
+					(static_cast<unsigned int>(clr.a) << 24));
+			}
+			default:
+			return 0;
+		}
+	}
+
+	template <typename T>
+	static void cell_to_int(cell_t sp_value, opaque_ptr &new_pData) noexcept
+	{
+		new_pData.emplace<T>(1);
+		new_pData.get<T>(0) = static_cast<T>(sp_value);
+	}
+
+	void cell_to_value(cell_t sp_value, opaque_ptr &new_pData) const noexcept
+	{
+		switch(type) {
+			case prop_types::int_:
+			cell_to_int<int>(sp_value, new_pData);
+			break;
+			case prop_types::short_:
+			cell_to_int<short>(sp_value, new_pData);
+			break;
+			case prop_types::char_:
+			cell_to_int<char>(sp_value, new_pData);
+			break;
+			case prop_types::unsigned_int:
+			cell_to_int<unsigned int>(sp_value, new_pData);
+			break;
+			case prop_types::unsigned_short:
+			cell_to_int<unsigned short>(sp_value, new_pData);
+			break;
+			case prop_types::unsigned_char:
+			cell_to_int<unsigned char>(sp_value, new_pData);
+			break;
+			case prop_types::bool_:
+			cell_to_int<bool>(sp_value, new_pData);
+			break;
+			case prop_types::float_: {
+				new_pData.emplace<float>(1);
+				new_pData.get<float>(0) = sp_ctof(sp_value);
+			} break;
+			case prop_types::ehandle: {
+				new_pData.emplace<EHANDLE>(1);
+				EHANDLE &new_value{new_pData.get<EHANDLE>(0)};
+				CBaseEntity *pEntity{gamehelpers->ReferenceToEntity(sp_value)};
+				if(pEntity) {
+					new_value = pEntity->GetRefEHandle();
+				} else {
+					new_value.Term();
+				}
+			} break;
+			case prop_types::color32_: {
+				new_pData.emplace<color32>(1);
+				color32 &new_value{new_pData.get<color32>(0)};
+				const unsigned int packed{static_cast<unsigned int>(sp_value)};
+				new_value.r = static_cast<byte>(packed & 0xFF);
+				new_value.g = static_cast<byte>((packed >> 8) & 0xFF);
+				new_value.b = static_cast<byte>((packed >> 16) & 0xFF);
+				new_value.a = static_cast<byte>((packed >> 24) & 0xFF);
+			} break;
+			default:
+			break;
+		}
+	}
+
+	void string_to_value(const char *str, opaque_ptr &new_pData) const noexcept
+	{
+		if(type == prop_types::tstring) {
+			new_pData.assign_tstring(str);
+		} else {
+			new_pData.assign_string(str);
+		}
+	}
+
+	bool client_value_to_value(const client_value_t &value, opaque_ptr &new_pData) const noexcept
+	{
+		switch(type) {
+			case prop_types::int_:
+			case prop_types::short_:
+			case prop_types::char_:
+			case prop_types::unsigned_int:
+			case prop_types::unsigned_short:
+			case prop_types::unsigned_char:
+			case prop_types::bool_:
+			case prop_types::ehandle:
+			case prop_types::color32_: {
+				if(value.kind != client_value_t::kind_t::int_) {
+					return false;
+				}
+				cell_to_value(value.i, new_pData);
+			} return true;
+			case prop_types::float_: {
+				if(value.kind != client_value_t::kind_t::float_) {
+					return false;
+				}
+				new_pData.emplace<float>(1);
+				new_pData.get<float>(0) = value.f;
+			} return true;
+			case prop_types::vector: {
+				if(value.kind != client_value_t::kind_t::vector) {
+					return false;
+				}
+				new_pData.emplace<Vector>(1);
+				Vector &new_value{new_pData.get<Vector>(0)};
+				new_value.x = value.vec[0];
+				new_value.y = value.vec[1];
+				new_value.z = value.vec[2];
+			} return true;
+			case prop_types::qangle: {
+				if(value.kind != client_value_t::kind_t::vector) {
+					return false;
+				}
+				new_pData.emplace<QAngle>(1);
+				QAngle &new_value{new_pData.get<QAngle>(0)};
+				new_value.x = value.vec[0];
+				new_value.y = value.vec[1];
+				new_value.z = value.vec[2];
+			} return true;
+			case prop_types::cstring:
+			case prop_types::tstring: {
+				if(value.kind != client_value_t::kind_t::string) {
+					return false;
+				}
+				string_to_value(value.str.c_str(), new_pData);
+			} return true;
+			default:
+			return false;
+		}
+	}
+
+	//false if the table did not change
+	//a client of -1 replaces every per-slot value with one that isn't tied to any slot
+	bool set_override(int client, opaque_ptr &&value, IPluginContext *owner) noexcept
+	{
+		if(client == -1) {
+			bool changed{clear_slot_overrides()};
+			if(assign_override(all_clients, std::move(value), owner)) {
+				changed = true;
+			}
+			return changed;
+		}
+
+		const std::size_t overrides_size{static_cast<std::size_t>(playerhelpers->GetMaxClients()+1)};
+		if(overrides.size() < overrides_size) {
+			overrides.resize(overrides_size);
+		}
+
+		if(client < 1 || static_cast<std::size_t>(client) >= overrides.size()) {
+			return false;
+		}
+
+		return assign_override(overrides[static_cast<std::size_t>(client)], std::move(value), owner);
+	}
+
+	bool clear_overrides_of_plugin(IPlugin *plugin) noexcept
+	{
+		if(overrides_count == 0) {
+			return false;
+		}
+
+		IPluginContext *owner{plugin->GetBaseContext()};
+
+		bool changed{false};
+		if(all_clients.set && all_clients.owner == owner) {
+			reset_override(all_clients);
+			changed = true;
+		}
+		const std::size_t overrides_size{overrides.size()};
+		for(std::size_t i{1}; i < overrides_size; ++i) {
+			if(overrides[i].set && overrides[i].owner == owner) {
+				reset_override(overrides[i]);
+				changed = true;
+			}
+		}
+		return changed;
+	}
+
+	//a client of -1 clears the value for every client as well as every per-slot value
+	bool clear_override(int client) noexcept
+	{
+		if(client == -1) {
+			bool changed{clear_slot_overrides()};
+			if(reset_override(all_clients)) {
+				changed = true;
+			}
+			return changed;
+		}
+
+		if(client < 1 || static_cast<std::size_t>(client) >= overrides.size()) {
+			return false;
+		}
+
+		return reset_override(overrides[static_cast<std::size_t>(client)]);
+	}
+
+	bool add_override_callback(const proxysend::client_override_callback *ptr) noexcept
+	{
+		if(std::find(override_callbacks.cbegin(), override_callbacks.cend(), ptr) != override_callbacks.cend()) {
+			return false;
+		}
+
+		override_callbacks.emplace_back(ptr);
+		update_per_client();
+		return true;
+	}
+
+	bool remove_override_callback(const proxysend::client_override_callback *ptr) noexcept
+	{
+		override_callbacks_t::const_iterator it{std::find(override_callbacks.cbegin(), override_callbacks.cend(), ptr)};
+		if(it == override_callbacks.cend()) {
+			return false;
+		}
+
+		override_callbacks.erase(it);
+		update_per_client();
+		return true;
+	}
+
+	//same as the forwards but for callbacks registered by other extensions
+	void call_override_callbacks(callback_results_t &out, const void *pData, int objectID, const std::vector<int> &slots) noexcept
+	{
+		const int entity{gamehelpers->IndexToReference(objectID)};
+		const char *prop_name{name};
+
+		for(int slot : slots) {
+			const int client{slot+1};
+			callback_result_t &result{out.current[static_cast<std::size_t>(client)]};
+			const void *value{result.changed ? result.value.get() : pData};
+
+			bool changed{false};
+
+			switch(type) {
+				case prop_types::float_: {
+					float new_value{*static_cast<const float *>(value)};
+					for(const proxysend::client_override_callback *it : override_callbacks) {
+						if(it->override_float(entity, prop_name, element, client, new_value)) {
+							changed = true;
+						}
+					}
+					if(changed) {
+						result.value.emplace<float>(1);
+						result.value.get<float>(0) = new_value;
+					}
+				} break;
+				case prop_types::vector:
+				case prop_types::qangle: {
+					const float *vec{static_cast<const float *>(value)};
+					float new_value[3]{vec[0], vec[1], vec[2]};
+					for(const proxysend::client_override_callback *it : override_callbacks) {
+						if(it->override_vector(entity, prop_name, element, client, new_value)) {
+							changed = true;
+						}
+					}
+					if(changed) {
+						if(type == prop_types::vector) {
+							result.value.emplace<Vector>(1);
+							Vector &vec_value{result.value.get<Vector>(0)};
+							vec_value.x = new_value[0];
+							vec_value.y = new_value[1];
+							vec_value.z = new_value[2];
+						} else {
+							result.value.emplace<QAngle>(1);
+							QAngle &vec_value{result.value.get<QAngle>(0)};
+							vec_value.x = new_value[0];
+							vec_value.y = new_value[1];
+							vec_value.z = new_value[2];
+						}
+					}
+				} break;
+				case prop_types::cstring:
+				case prop_types::tstring: {
+					char (&new_value)[sizeof(string_scratch_t::value)]{pack_scratch.string.value};
+					const char *str{type == prop_types::tstring ? STRING(*static_cast<const string_t *>(value)) : static_cast<const char *>(value)};
+					std::size_t len{strlen(str)};
+					if(len >= sizeof(new_value)) {
+						len = sizeof(new_value)-1;
+					}
+					memcpy(new_value, str, len);
+					new_value[len] = '\0';
+					for(const proxysend::client_override_callback *it : override_callbacks) {
+						if(it->override_string(entity, prop_name, element, client, new_value, sizeof(new_value))) {
+							changed = true;
+						}
+					}
+					if(changed) {
+						string_to_value(new_value, result.value);
+					}
+				} break;
+				default: {
+					int new_value{value_to_cell(value)};
+					for(const proxysend::client_override_callback *it : override_callbacks) {
+						if(it->override_int(entity, prop_name, element, client, new_value)) {
+							changed = true;
+						}
+					}
+					if(changed) {
+						cell_to_value(new_value, result.value);
+					}
+				} break;
+			}
+
+			if(changed) {
+				result.changed = true;
+			}
+		}
+	}
+
+	//one call for every client, clients that already got a value from a regular callback start with it
+	void fwd_call_batch(callback_results_t &out, const void *pData, int objectID, const std::vector<int> &slots) noexcept
+	{
+		const std::size_t count{slots.size()};
+		if(count == 0) {
+			return;
+		}
+
+		pack_scratch_t &scratch{pack_scratch};
+		std::vector<cell_t> &sp_clients{scratch.batch_clients};
+		std::vector<cell_t> &sp_values{scratch.batch_values};
+		std::vector<cell_t> &sp_old_values{scratch.batch_old_values};
+		sp_clients.resize(count);
+		sp_values.resize(count);
+
+		const cell_t sp_real_value{value_to_cell(pData)};
+		for(std::size_t i{0}; i < count; ++i) {
+			const int client{slots[i]+1};
+			sp_clients[i] = client;
+			const callback_result_t &result{out.current[static_cast<std::size_t>(client)]};
+			sp_values[i] = (result.changed ? value_to_cell(result.value.get()) : sp_real_value);
+		}
+		sp_old_values = sp_values;
+
+		IChangeableForward *batch_fwd{batch_entry->fwd};
+		batch_fwd->PushCell(objectID);
+		batch_fwd->PushStringEx((char *)name, strlen(name)+1, SM_PARAM_STRING_COPY|SM_PARAM_STRING_UTF8, 0);
+		batch_fwd->PushArray(sp_clients.data(), static_cast<unsigned int>(count), 0);
+		batch_fwd->PushArray(sp_values.data(), static_cast<unsigned int>(count), SM_PARAM_COPYBACK);
+		batch_fwd->PushCell(static_cast<cell_t>(count));
+		batch_fwd->PushCell(element);
+		cell_t res{Pl_Continue};
+		batch_fwd->Execute(&res);
+		if(res != Pl_Changed) {
+			return;
+		}
+
+		for(std::size_t i{0}; i < count; ++i) {
+			if(sp_values[i] == sp_old_values[i]) {
+				continue;
+			}
+			callback_result_t &result{out.current[static_cast<std::size_t>(sp_clients[i])]};
+			cell_to_value(sp_values[i], result.value);
+			result.changed = true;
+		}
+	}
+
+	const void *get_result(const callback_results_t &res, int client) const noexcept
+	{
+		std::size_t idx{0};
+		if(res.per_client) {
+			if(client == -1) {
+				return nullptr;
+			}
+			idx = static_cast<std::size_t>(client);
+
+			//static values always win over callbacks
+			if(idx < overrides.size() && overrides[idx].set) {
+				return overrides[idx].value.get();
+			}
+			if(all_clients.set) {
+				return all_clients.value.get();
+			}
+		}
+
+		if(idx >= res.current.size()) {
+			return nullptr;
+		}
+
+		const callback_result_t &result{res.current[idx]};
+		if(!result.changed) {
+			return nullptr;
+		}
+
+		return result.value.get();
+	}
+
+	//only per-client results, global ones are already part of the shared packed data
+	inline bool has_client_result(const callback_results_t &res, int client) const noexcept
+	{ return res.per_client && get_result(res, client) != nullptr; }
+
+	bool same_client_result(const callback_results_t &res, int client1, int client2) const noexcept
+	{
+		if(!res.per_client) {
+			return true;
+		}
+
+		return same_value(get_result(res, client1), get_result(res, client2));
+	}
+
+	//if any result differs from the previous evaluate
+	bool results_changed(const callback_results_t &res) const noexcept
+	{
+		const std::size_t size{std::max(res.current.size(), res.prev.size())};
+		for(std::size_t i{0}; i < size; ++i) {
+			const void *value{(i < res.current.size() && res.current[i].changed) ? res.current[i].value.get() : nullptr};
+			const void *prev_value{(i < res.prev.size() && res.prev[i].changed) ? res.prev[i].value.get() : nullptr};
+			if(!same_value(value, prev_value)) {
+				return true;
+			}
 		}
 		return false;
 	}
 
+	inline bool same_value(const void *value1, const void *value2) const noexcept
+	{
+		if(!value1 || !value2) {
+			return (value1 == value2);
+		}
+
+		return value_compare(value1, value2);
+	}
+
+	template <typename T>
+	static bool same_value_of(const void *value1, const void *value2) noexcept
+	{ return (*static_cast<const T *>(value1) == *static_cast<const T *>(value2)); }
+
+	static bool same_color32(const void *value1, const void *value2) noexcept
+	{ return (memcmp(value1, value2, sizeof(color32)) == 0); }
+
+	static bool same_cstring(const void *value1, const void *value2) noexcept
+	{ return (strcmp(static_cast<const char *>(value1), static_cast<const char *>(value2)) == 0); }
+
+	static bool same_tstring(const void *value1, const void *value2) noexcept
+	{ return (strcmp(STRING(*static_cast<const string_t *>(value1)), STRING(*static_cast<const string_t *>(value2))) == 0); }
+
+	static bool same_nothing(const void *, const void *) noexcept
+	{ return false; }
+
+	static same_value_t get_value_compare(prop_types type) noexcept
+	{
+		switch(type) {
+			case prop_types::int_:
+			case prop_types::unsigned_int:
+			return same_value_of<int>;
+			case prop_types::short_:
+			case prop_types::unsigned_short:
+			return same_value_of<short>;
+			case prop_types::char_:
+			case prop_types::unsigned_char:
+			return same_value_of<char>;
+			case prop_types::bool_:
+			return same_value_of<bool>;
+			case prop_types::float_:
+			return same_value_of<float>;
+			case prop_types::vector:
+			return same_value_of<Vector>;
+			case prop_types::qangle:
+			return same_value_of<QAngle>;
+			case prop_types::color32_:
+			return same_color32;
+			case prop_types::ehandle:
+			return same_value_of<EHANDLE>;
+			case prop_types::cstring:
+			return same_cstring;
+			case prop_types::tstring:
+			return same_tstring;
+		}
+
+		return same_nothing;
+	}
+
 	void proxy_call(const SendProp *pProp, const void *pStructBase, const void *pOldData, const void *pNewData, DVariant *pOut, int iElement, int objectID) const noexcept
 	{
 	#if SOURCE_ENGINE == SE_TF2
@@ -1272,28 +2361,56 @@ struct callback_t final : prop_reference_t
 
 	callback_t &operator=(callback_t &&other) noexcept
 	{
-		fwd = other.fwd;
-		other.fwd = nullptr;
+		if(tracked_per_client) {
+			change_per_client_count(edict, server_class, false);
+		}
+		fwd_entry = other.fwd_entry;
+		other.fwd_entry = nullptr;
+		batch_entry = other.batch_entry;
+		other.batch_entry = nullptr;
 		prop = other.prop;
 		other.prop = nullptr;
 		offset = other.offset;
 		type = other.type;
+		fwd_caller = other.fwd_caller;
+		value_compare = other.value_compare;
 		ref = other.ref;
 		other.ref = INVALID_EHANDLE_INDEX;
-		name = std::move(other.name);
+		edict = other.edict;
+		server_class = other.server_class;
+		tracked_per_client = other.tracked_per_client;
+		other.tracked_per_client = false;
+		name = other.name;
+		other.name = nullptr;
 		element = other.element;
 		other.element = 0;
 		per_client_funcs = std::move(other.per_client_funcs);
+		results = std::move(other.results);
+		entity_results = std::move(other.entity_results);
+		overrides = std::move(other.overrides);
+		all_clients = std::move(other.all_clients);
+		overrides_count = other.overrides_count;
+		other.overrides_count = 0;
+		override_callbacks = std::move(other.override_callbacks);
 		return *this;
 	}
 
-	IChangeableForward *fwd{nullptr};
+	//both owned by forward_pool, null when there are no functions
+	const forward_pool_t::entry_t *fwd_entry{nullptr};
+	const forward_pool_t::entry_t *batch_entry{nullptr};
 	std::size_t offset{-1};
 	prop_types type{prop_types::unknown};
 	int element{0};
-	std::string name{};
+	//for array elements the name of the array, owned by the SendTable
+	const char *name{nullptr};
 	SendProp *prop{nullptr};
 	unsigned long ref{INVALID_EHANDLE_INDEX};
+	//what per_client_edicts or per_client_classes counts this callback under
+	int edict{-1};
+	const ServerClass *server_class{nullptr};
+	bool tracked_per_client{false};
+	fwd_call_t fwd_caller{&callback_t::fwd_call_nop};
+	same_value_t value_compare{same_nothing};
 
 	struct per_client_func_t
 	{
@@ -1323,8 +2440,84 @@ struct callback_t final : prop_reference_t
 	using per_client_funcs_t = std::vector<per_client_func_t>;
 	per_client_funcs_t per_client_funcs{};
 
-private:
-	callback_t(const callback_t &) = delete;
+	//results of an entity callback
+	callback_results_t results{};
+	//results of a class callback for every entity of the class it ran on, by edict
+	std::unordered_map<int, callback_results_t> entity_results{};
+
+	//values set directly through the interface or natives, indexed by client
+	struct override_t final
+	{
+		bool set{false};
+		opaque_ptr value{};
+		//plugin that set the value, overrides from other extensions have none
+		IPluginContext *owner{nullptr};
+	};
+
+	std::vector<override_t> overrides{};
+	//set with a client of -1, kept apart so a disconnect only clears that slot
+	override_t all_clients{};
+	//includes all_clients
+	std::size_t overrides_count{0};
+
+	using override_callbacks_t = std::vector<const proxysend::client_override_callback *>;
+	override_callbacks_t override_callbacks{};
+
+private:
+	bool assign_override(override_t &it, opaque_ptr &&value, IPluginContext *owner) noexcept
+	{
+		if(it.set) {
+			if(same_value(it.value.get(), value.get())) {
+				it.owner = owner;
+				return false;
+			}
+		} else {
+			it.set = true;
+			++overrides_count;
+			update_per_client();
+		}
+
+		it.value = std::move(value);
+		it.owner = owner;
+		return true;
+	}
+
+	bool clear_slot_overrides() noexcept
+	{
+		bool changed{false};
+		for(override_t &it : overrides) {
+			if(reset_override(it)) {
+				changed = true;
+			}
+		}
+		return changed;
+	}
+
+	bool reset_override(override_t &it) noexcept
+	{
+		if(!it.set) {
+			return false;
+		}
+
+		it.set = false;
+		it.value.clear();
+		it.owner = nullptr;
+		--overrides_count;
+		update_per_client();
+		return true;
+	}
+
+	//called after anything has_any_per_client_func looks at changes
+	void update_per_client() noexcept
+	{
+		const bool per_client{has_any_per_client_func()};
+		if(per_client != tracked_per_client) {
+			tracked_per_client = per_client;
+			change_per_client_count(edict, server_class, per_client);
+		}
+	}
+
+	callback_t(const callback_t &) = delete;
 	callback_t &operator=(const callback_t &) = delete;
 	callback_t() = delete;
 };
@@ -1335,9 +2528,11 @@ struct proxyhook_t final
 {
 	callbacks_t callbacks;
 	unsigned long ref{INVALID_EHANDLE_INDEX};
+	//only set for class hooks
+	const ServerClass *server_class{nullptr};
 
-	inline proxyhook_t(unsigned long ref_) noexcept
-		: ref{ref_}
+	inline proxyhook_t(unsigned long ref_, const ServerClass *server_class_) noexcept
+		: ref{ref_}, server_class{server_class_}
 	{
 	}
 
@@ -1345,14 +2540,23 @@ struct proxyhook_t final
 	{
 	}
 
-	void add_callback(SendProp *pProp, std::string &&name, int element, prop_types type, int offset, IPluginFunction *func, bool per_client) noexcept
+	callback_t &get_callback(SendProp *pProp, const char *name, int element, prop_types type, int offset) noexcept
 	{
 		callbacks_t::iterator it_callback{callbacks.find(pProp)};
 		if(it_callback == callbacks.end()) {
-			it_callback = callbacks.emplace(std::pair<const SendProp *, callback_t>{pProp, callback_t{ref, pProp, std::move(name), element, type, offset}}).first;
+			it_callback = callbacks.emplace(std::pair<const SendProp *, callback_t>{pProp, callback_t{ref, server_class, pProp, name, element, type, offset}}).first;
 		}
+		return it_callback->second;
+	}
 
-		it_callback->second.add_function(func, per_client);
+	void add_callback(SendProp *pProp, const char *name, int element, prop_types type, int offset, IPluginFunction *func, bool per_client, bool batch) noexcept
+	{
+		callback_t &callback{get_callback(pProp, name, element, type, offset)};
+		if(batch) {
+			callback.add_batch_function(func);
+		} else {
+			callback.add_function(func, per_client);
+		}
 	}
 
 	inline proxyhook_t(proxyhook_t &&other) noexcept
@@ -1363,6 +2567,8 @@ struct proxyhook_t final
 		callbacks = std::move(other.callbacks);
 		ref = other.ref;
 		other.ref = INVALID_EHANDLE_INDEX;
+		server_class = other.server_class;
+		other.server_class = nullptr;
 		return *this;
 	}
 
@@ -1375,16 +2581,299 @@ private:
 using hooks_t = std::unordered_map<unsigned long, proxyhook_t>;
 static hooks_t hooks;
 
-DETOUR_DECL_STATIC6(SendTable_Encode, bool, const SendTable *, pTable, const void *, pStruct, bf_write *, pOut, int, objectID, CUtlMemory<CSendProxyRecipients> *, pRecipients, bool, bNonZeroOnly)
+//callbacks evaluated this tick, rebuilt by SV_ComputeClientPacks
+//so global_send_proxy can find the results by edict without going through the hook maps
+class hook_results_t final
+{
+public:
+	struct entry_t final
+	{
+		const callback_t *callback{nullptr};
+		const callback_results_t *results{nullptr};
+	};
+
+	hook_results_t() noexcept
+	{ edicts.fill(-1); }
+	~hook_results_t() noexcept = default;
+
+	void begin_tick() noexcept
+	{
+		for(const int edict : entities) {
+			edicts[static_cast<std::size_t>(edict)] = -1;
+		}
+		entities.clear();
+		rows.clear();
+		width = 0;
+	}
+
+	//callbacks of the entity itself replace the class ones of the same prop, they already ran both
+	void add(int edict, const proxyhook_t *hook, const proxyhook_t *class_hook) noexcept
+	{
+		if(edict < 0 || edict >= MAX_EDICTS) {
+			return;
+		}
+
+		//props hooked after the first entity was added are left out until next tick
+		if(entities.empty()) {
+			width = restore_index_count;
+		}
+
+		const std::size_t begin{rows.size()};
+		rows.resize(begin + width);
+		if(class_hook) {
+			for(const auto &it_callback : class_hook->callbacks) {
+				const callback_t &callback{it_callback.second};
+				const std::size_t index{callback.restore->index};
+				if(index >= width) {
+					continue;
+				}
+				std::unordered_map<int, callback_results_t>::const_iterator it_results{callback.entity_results.find(edict)};
+				if(it_results != callback.entity_results.cend()) {
+					rows[begin + index] = entry_t{&callback, &it_results->second};
+				}
+			}
+		}
+		if(hook) {
+			for(const auto &it_callback : hook->callbacks) {
+				const callback_t &callback{it_callback.second};
+				const std::size_t index{callback.restore->index};
+				if(index < width) {
+					rows[begin + index] = entry_t{&callback, &callback.results};
+				}
+			}
+		}
+
+		edicts[static_cast<std::size_t>(edict)] = static_cast<int>(entities.size());
+		entities.emplace_back(edict);
+	}
+
+	const entry_t *find(int edict, std::size_t index) const noexcept
+	{
+		if(index >= width) {
+			return nullptr;
+		}
+
+		const entry_t *row{find_row(edict)};
+		if(!row || !row[index].callback) {
+			return nullptr;
+		}
+
+		return &row[index];
+	}
+
+	bool has_client_result(int edict, int client) const noexcept
+	{
+		const entry_t *row{find_row(edict)};
+		if(!row) {
+			return false;
+		}
+
+		for(std::size_t i{0}; i < width; ++i) {
+			if(row[i].callback && row[i].callback->has_client_result(*row[i].results, client)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool same_client_results(int edict, int client1, int client2) const noexcept
+	{
+		const entry_t *row{find_row(edict)};
+		if(!row) {
+			return true;
+		}
+
+		for(std::size_t i{0}; i < width; ++i) {
+			if(row[i].callback && !row[i].callback->same_client_result(*row[i].results, client1, client2)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void clear() noexcept
+	{
+		begin_tick();
+		entities.shrink_to_fit();
+		rows.shrink_to_fit();
+	}
+
+private:
+	const entry_t *find_row(int edict) const noexcept
+	{
+		if(edict < 0 || edict >= MAX_EDICTS) {
+			return nullptr;
+		}
+
+		const int idx{edicts[static_cast<std::size_t>(edict)]};
+		if(idx == -1) {
+			return nullptr;
+		}
+
+		return &rows[static_cast<std::size_t>(idx) * width];
+	}
+
+	std::array<int, MAX_EDICTS> edicts;
+	std::vector<int> entities{};
+	//one row of width entries per entity, indexed by proxyrestore_t::index
+	std::vector<entry_t> rows{};
+	std::size_t width{0};
+
+	hook_results_t(const hook_results_t &) = delete;
+	hook_results_t &operator=(const hook_results_t &) = delete;
+	hook_results_t(hook_results_t &&) = delete;
+	hook_results_t &operator=(hook_results_t &&) = delete;
+};
+
+static hook_results_t hook_results{};
+
+//set while evaluate_hooks runs, anything that would change the hook maps is queued until it's done
+static bool evaluating_hooks{false};
+
+//runs every callback of an entity and of its class once per relevant client ahead of packing
+//and marks the entity as changed only when an output differs from last tick
+static void evaluate_hooks(int idx, unsigned long ref, CBaseEntity *pEntity, proxyhook_t *hook, proxyhook_t *class_hook, const std::vector<int> &slots) noexcept
+{
+	VPROF_BUDGET("proxysend::evaluate_hooks", VPROF_BUDGETGROUP_OTHER_NETWORKING);
+
+	const unsigned char *pStruct{reinterpret_cast<const unsigned char *>(pEntity)};
+
+	bool changed{false};
+	if(hook) {
+		for(auto &it_callback : hook->callbacks) {
+			callback_t &callback{it_callback.second};
+			const callback_t *class_callback{nullptr};
+			if(class_hook) {
+				callbacks_t::const_iterator it_class_callback{class_hook->callbacks.find(it_callback.first)};
+				if(it_class_callback != class_hook->callbacks.cend()) {
+					class_callback = &it_class_callback->second;
+				}
+			}
+			callback.evaluate(callback.results, class_callback, pStruct + callback.offset, idx, slots);
+			if(!changed) {
+				changed = callback.results_changed(callback.results);
+			}
+		}
+	}
+
+	if(class_hook) {
+		for(auto &it_callback : class_hook->callbacks) {
+			if(hook && hook->callbacks.find(it_callback.first) != hook->callbacks.end()) {
+				continue;
+			}
+			callback_t &callback{it_callback.second};
+			callback_results_t &results{callback.entity_results[idx]};
+			if(results.ref != ref) {
+				results = callback_results_t{};
+				results.ref = ref;
+			}
+			callback.evaluate(results, nullptr, pStruct + callback.offset, idx, slots);
+			if(!changed) {
+				changed = callback.results_changed(results);
+			}
+		}
+	}
+
+	if(changed) {
+		edict_t *edict{pEntity->GetNetworkable()->GetEdict()};
+		if(edict) {
+			gamehelpers->SetEdictStateChanged(edict, 0);
+		}
+	}
+}
+
+//splits the clients of every per-client entity into classes with identical callback results
+//so each class is encoded once, clients without any per-client result just use the global data
+static void group_clients(pack_entity_params_t &params) noexcept
+{
+	const std::size_t slots_size{params.slots.size()};
+
+	for(entity_packs_t &packs : params.entity_data) {
+		for(std::size_t i{0}; i < slots_size; ++i) {
+			const int slot{params.slots[i]};
+			if(!hook_results.has_client_result(packs.edict, slot+1)) {
+				continue;
+			}
+
+			int class_idx{-1};
+			const std::size_t classes_size{packs.classes.size()};
+			for(std::size_t j{0}; j < classes_size; ++j) {
+				if(hook_results.same_client_results(packs.edict, packs.classes[j].slot+1, slot+1)) {
+					class_idx = static_cast<int>(j);
+					break;
+				}
+			}
+
+			if(class_idx == -1) {
+				class_idx = static_cast<int>(classes_size);
+				packs.classes.emplace_back();
+				packs.classes.back().reset(slot);
+			}
+
+			packs.slot_class[i] = class_idx;
+		}
+	}
+}
+
+//mirrors the keys of hooks by edict index so unhooked entities can be rejected with a single bit test
+static std::bitset<MAX_EDICTS> hooked_edicts;
+
+//same edicts kept sorted so SV_ComputeClientPacks only walks the hooked ones
+static std::vector<int> hooked_edict_list;
+
+static void set_index_hooked(int idx, bool hooked) noexcept
+{
+	if(idx < 0 || idx >= MAX_EDICTS || hooked_edicts.test(static_cast<std::size_t>(idx)) == hooked) {
+		return;
+	}
+
+	hooked_edicts.set(static_cast<std::size_t>(idx), hooked);
+
+	std::vector<int>::iterator it{std::lower_bound(hooked_edict_list.begin(), hooked_edict_list.end(), idx)};
+	if(hooked) {
+		hooked_edict_list.emplace(it, idx);
+	} else if(it != hooked_edict_list.end() && *it == idx) {
+		hooked_edict_list.erase(it);
+	}
+}
+
+static inline void set_edict_hooked(unsigned long ref, bool hooked) noexcept
+{ set_index_hooked(::ReferenceToIndex(ref), hooked); }
+
+static inline bool is_edict_hooked(int idx) noexcept
+{ return (idx >= 0 && idx < MAX_EDICTS && hooked_edicts.test(static_cast<std::size_t>(idx))); }
+
+//hooks shared by every entity of a ServerClass, evaluated straight from here
+//so entities of the class only get hook state of their own when they are hooked themselves
+using class_hooks_t = std::unordered_map<const ServerClass *, proxyhook_t>;
+static class_hooks_t class_hooks;
+
+//every entity a class callback that is about to be erased ran on has to resend the real value
+static void change_class_callback_state(const callback_t &callback) noexcept
 {
-	do_calc_delta = false;
+	for(const auto &it_results : callback.entity_results) {
+		CBaseEntity *pEntity{::ReferenceToEntity(it_results.second.ref)};
+		if(pEntity) {
+			edict_t *edict{pEntity->GetNetworkable()->GetEdict()};
+			if(edict) {
+				gamehelpers->SetEdictStateChanged(edict, 0);
+			}
+		}
+	}
+}
 
-	if(!packentity_params || !in_compute_packs) {
+DETOUR_DECL_STATIC6(SendTable_Encode, bool, const SendTable *, pTable, const void *, pStruct, bf_write *, pOut, int, objectID, CUtlMemory<CSendProxyRecipients> *, pRecipients, bool, bNonZeroOnly)
+{
+	if(!in_compute_packs || !packentity_params) {
 		return DETOUR_STATIC_CALL(SendTable_Encode)(pTable, pStruct, pOut, objectID, pRecipients, bNonZeroOnly);
 	}
 
+	pack_context_t &context{pack_context};
+
+	context.do_calc_delta = false;
+
 	{
-		sendproxy_client_slot = -1;
+		context.sendproxy_client_slot = -1;
 		if(!DETOUR_STATIC_CALL(SendTable_Encode)(pTable, pStruct, pOut, objectID, pRecipients, bNonZeroOnly)) {
 			Host_Error( "SV_PackEntity: SendTable_Encode returned false (ent %d).\n", objectID );
 			return false;
@@ -1393,26 +2882,27 @@ DETOUR_DECL_STATIC6(SendTable_Encode, bool, const SendTable *, pTable, const voi
 
 	unsigned long ref{::IndexToReference(objectID)};
 
-	const std::vector<unsigned long> &entities{packentity_params->entities};
-	if(std::find(entities.cbegin(), entities.cend(), ref) != entities.cend()) {
-		const std::size_t slots_size{packentity_params->slots.size()};
-		for(std::size_t i{0}; i < slots_size; ++i) {
-			std::vector<packed_entity_data_t> &vec{packentity_params->entity_data[i]};
-			vec.emplace_back();
-			packed_entity_data_t &packedData{vec.back()};
-
-			packedData.ref = ref;
-			packedData.allocate();
-
-			sendproxy_client_slot = packentity_params->slots[i];
-			const bool encoded{DETOUR_STATIC_CALL(SendTable_Encode)(pTable, pStruct, packedData.writeBuf, objectID, pRecipients, bNonZeroOnly)};
-			sendproxy_client_slot = -1;
+	const std::size_t entity_idx{packentity_params->entity_index(objectID, ref)};
+	if(entity_idx != static_cast<std::size_t>(-1)) {
+		entity_packs_t &packs{packentity_params->entity_data[entity_idx]};
+		for(packed_entity_data_t &packedData : packs.classes) {
+			//same as SV_PackEntity, the buffer only needs to live until it is copied into the arena
+			alignas(4) char tmpData[MAX_PACKEDENTITY_DATA];
+			bf_write writeBuf{"SV_PackEntity->writeBuf", tmpData, sizeof(tmpData)};
+
+			context.sendproxy_client_slot = packedData.slot;
+			const bool encoded{DETOUR_STATIC_CALL(SendTable_Encode)(pTable, pStruct, &writeBuf, objectID, pRecipients, bNonZeroOnly)};
+			context.sendproxy_client_slot = -1;
 			if(!encoded) {
 				Host_Error( "SV_PackEntity: SendTable_Encode returned false (ent %d).\n", objectID );
 				return false;
 			}
+
+			packentity_params->store(packedData, writeBuf);
 		}
-		do_calc_delta = true;
+		context.do_calc_delta = true;
+	} else if(packentity_params->prev_entity_index(objectID, ref) != static_cast<std::size_t>(-1)) {
+		context.do_calc_delta = true;
 	}
 
 	return true;
@@ -1420,70 +2910,74 @@ DETOUR_DECL_STATIC6(SendTable_Encode, bool, const SendTable *, pTable, const voi
 
 DETOUR_DECL_STATIC8(SendTable_CalcDelta, int, const SendTable *, pTable, const void *, pFromState, const int, nFromBits, const void *, pToState, const int, nToBits, int *, pDeltaProps, int, nMaxDeltaProps, const int, objectID)
 {
-	if(!packentity_params || !in_compute_packs || !do_calc_delta) {
+	pack_context_t &context{pack_context};
+
+	if(!in_compute_packs || !packentity_params || !context.do_calc_delta) {
 		return DETOUR_STATIC_CALL(SendTable_CalcDelta)(pTable, pFromState, nFromBits, pToState, nToBits, pDeltaProps, nMaxDeltaProps, objectID);
 	}
 
-	do_calc_delta = false;
+	context.do_calc_delta = false;
 
 	int global_nChanges{DETOUR_STATIC_CALL(SendTable_CalcDelta)(pTable, pFromState, nFromBits, pToState, nToBits, pDeltaProps, nMaxDeltaProps, objectID)};
 	int total_nChanges{global_nChanges};
 
 	if(total_nChanges < nMaxDeltaProps) {
-		int *client_deltaProps{new int[nMaxDeltaProps]{}};
+		calcdelta_scratch_t &scratch{pack_scratch.calcdelta};
+		scratch.prepare(nMaxDeltaProps);
 
-		int new_nChanges{total_nChanges};
+		for(int j{0}; j < total_nChanges; ++j) {
+			scratch.test_and_set(pDeltaProps[j]);
+		}
 
 		unsigned long ref = ::IndexToReference(objectID);
 
-		const std::size_t slots_size{packentity_params->slots.size()};
-		for(std::size_t i{0}; i < slots_size; ++i) {
-			using entity_data_t = std::vector<packed_entity_data_t>;
-			entity_data_t &entity_data{packentity_params->entity_data[i]};
+		const auto merge_delta{
+			[&](const void *pFrom, int nFrom, const void *pTo, int nTo) noexcept -> bool {
+				const int client_nChanges{DETOUR_STATIC_CALL(SendTable_CalcDelta)(pTable, pFrom, nFrom, pTo, nTo, scratch.props.data(), nMaxDeltaProps, objectID)};
 
-			packed_entity_data_t *packedData{nullptr};
-			for(entity_data_t::reverse_iterator it{entity_data.rbegin()}; it != entity_data.rend(); ++it) {
-				if(it->ref == ref) {
-					packedData = &(*it);
-					break;
+				for(int j{0}; j < client_nChanges; ++j) {
+					const int prop{scratch.props[j]};
+					if(!scratch.test_and_set(prop)) {
+						pDeltaProps[total_nChanges++] = prop;
+						if(total_nChanges >= nMaxDeltaProps) {
+							return false;
+						}
+					}
 				}
-			}
 
-			if(!packedData || !packedData->written()) {
-				continue;
+				return true;
 			}
+		};
 
-			const int client_nChanges{DETOUR_STATIC_CALL(SendTable_CalcDelta)(pTable, pFromState, nFromBits, packedData->packedData, packedData->writeBuf->GetNumBitsWritten(), client_deltaProps, nMaxDeltaProps, objectID)};
-			int client_nChanges_new{0};
-
-			bool done{false};
+		bool done{false};
 
-			for(int j{0}; j < client_nChanges; ++j) {
-				bool found{false};
-				for(int k{0}; k < new_nChanges; ++k) {
-					if(pDeltaProps[k] == client_deltaProps[j]) {
-						found = true;
-						break;
-					}
-				}
-				if(!found) {
-					++client_nChanges_new;
-					pDeltaProps[total_nChanges++] = client_deltaProps[j];
-					if(total_nChanges >= nMaxDeltaProps) {
-						done = true;
-						break;
-					}
-				}
+		const std::size_t entity_idx{packentity_params->entity_index(objectID, ref)};
+		const std::size_t classes_size{entity_idx != static_cast<std::size_t>(-1) ? packentity_params->entity_data[entity_idx].classes.size() : 0};
+		for(std::size_t i{0}; i < classes_size && !done; ++i) {
+			const packed_entity_data_t &packedData{packentity_params->entity_data[entity_idx].classes[i]};
+			if(!packedData.written()) {
+				continue;
 			}
 
-			if(done) {
-				break;
+			done = !merge_delta(pFromState, nFromBits, packedData.packedData, packedData.nBits);
+		}
+
+		//the engine only compares against the global data it sent last tick
+		//but clients with an override last tick got something else
+		const std::size_t prev_entity_idx{packentity_params->prev_entity_index(objectID, ref)};
+		const std::size_t prev_classes_size{prev_entity_idx != static_cast<std::size_t>(-1) ? packentity_params->prev_entity_data[prev_entity_idx].classes.size() : 0};
+		for(std::size_t i{0}; i < prev_classes_size && !done; ++i) {
+			const packed_entity_data_t &packedData{packentity_params->prev_entity_data[prev_entity_idx].classes[i]};
+			if(!packedData.written()) {
+				continue;
 			}
 
-			new_nChanges += client_nChanges_new;
+			done = !merge_delta(packedData.packedData, packedData.nBits, pToState, nToBits);
 		}
 
-		delete[] client_deltaProps;
+		for(int j{0}; j < total_nChanges; ++j) {
+			scratch.clear(pDeltaProps[j]);
+		}
 	}
 
 	if(total_nChanges > nMaxDeltaProps) {
@@ -1493,6 +2987,15 @@ DETOUR_DECL_STATIC8(SendTable_CalcDelta, int, const SendTable *, pTable, const v
 	return total_nChanges;
 }
 
+class CFrameSnapshotEntry
+{
+public:
+	ServerClass*			m_pClass;
+	int						m_nSerialNumber;
+	// Keeps track of the fullpack info for this frame for all entities in any pvs:
+	int						m_pPackedData;
+};
+
 class CFrameSnapshot
 {
 public:
@@ -1524,9 +3027,15 @@ private:
 	CInterlockedInt			m_nReferences;
 };
 
+//the same test TakeTickSnapshot does for m_pValidEntities, unused edicts and inactive clients have no class
+static inline bool is_in_snapshot(const CFrameSnapshot *snapshot, int idx) noexcept
+{ return (idx >= 0 && idx < snapshot->m_nNumEntities && snapshot->m_pEntities[idx].m_pClass != nullptr); }
+
 DETOUR_DECL_MEMBER2(CFrameSnapshotManager_GetPackedEntity, PackedEntity *, CFrameSnapshot *, pSnapshot, int, entity)
 {
-	if(!pSnapshot || !packentity_params || !writedeltaentities_client || packentity_params->snapshot_index != pSnapshot->m_ListIndex) {
+	const int slot{pack_context.writedeltaentities_client};
+
+	if(!do_writedelta_entities || !pSnapshot || !packentity_params || slot == -1 || packentity_params->snapshot_index != pSnapshot->m_ListIndex) {
 		return DETOUR_MEMBER_CALL(CFrameSnapshotManager_GetPackedEntity)(pSnapshot, entity);
 	}
 
@@ -1535,33 +3044,17 @@ DETOUR_DECL_MEMBER2(CFrameSnapshotManager_GetPackedEntity, PackedEntity *, CFram
 		return nullptr;
 	}
 
-	const int slot{writedeltaentities_client};
-
 	unsigned long ref{::IndexToReference(entity)};
 
 	const packed_entity_data_t *packedData{nullptr};
-	const std::size_t slots_size{packentity_params->slots.size()};
-	for(std::size_t i{0}; i < slots_size; ++i) {
-		if(packentity_params->slots[i] == slot) {
-			const std::vector<packed_entity_data_t> &entity_data{packentity_params->entity_data[i]};
-			for(const packed_entity_data_t &it : entity_data) {
-				if(it.ref == ref) {
-					if(it.written()) {
-						packedData = &it;
-					}
-					break;
-				}
-			}
-			break;
-		}
+	const std::size_t entity_idx{packentity_params->entity_index(entity, ref)};
+	const std::size_t slot_idx{packentity_params->slot_index(slot)};
+	if(entity_idx != static_cast<std::size_t>(-1) && slot_idx != static_cast<std::size_t>(-1)) {
+		packedData = packentity_params->entity_data[entity_idx].get(slot_idx);
 	}
 
 	if(packedData) {
-		if(packed->GetData()) {
-			packed->FreeData();
-		}
-
-		packed->AllocAndCopyPadded(packedData->packedData, packedData->writeBuf->GetNumBytesWritten());
+		return packentity_params->get_shadow(packed, *packedData);
 	}
 
 	return packed;
@@ -1606,15 +3099,19 @@ void PreWriteDeltaEntities(CBaseClient *client)
 {
 	if(do_writedelta_entities) {
 		if(!is_client_valid(client)) {
-			writedeltaentities_client = -1;
+			pack_context.writedeltaentities_client = -1;
 		} else {
-			writedeltaentities_client = client->GetPlayerSlot();
+			pack_context.writedeltaentities_client = client->GetPlayerSlot();
 		}
 	}
 
 	for(auto it : g_Sample.pack_ent_listeners) {
 		it->pre_write_deltas();
 	}
+
+	for(const Sample::batch_listener_t &it : g_Sample.batch_listeners) {
+		it.listener->pre_write_deltas();
+	}
 }
 
 void PostWriteDeltaEntities()
@@ -1623,8 +3120,12 @@ void PostWriteDeltaEntities()
 		it->post_write_deltas();
 	}
 
+	for(const Sample::batch_listener_t &it : g_Sample.batch_listeners) {
+		it.listener->post_write_deltas();
+	}
+
 	if(do_writedelta_entities) {
-		writedeltaentities_client = -1;
+		pack_context.writedeltaentities_client = -1;
 	}
 }
 
@@ -1647,20 +3148,59 @@ static CDetour *CBaseServer_WriteDeltaEntities_detour{nullptr};
 static ConVar *sv_parallel_packentities{nullptr};
 static ConVar *sv_parallel_sendsnapshot{nullptr};
 
-DETOUR_DECL_STATIC0(InvalidateSharedEdictChangeInfos, void)
-{
-	DETOUR_STATIC_CALL(InvalidateSharedEdictChangeInfos)();
-}
+static ConVar proxysend_parallel_pack{"proxysend_parallel_pack", "1", FCVAR_NONE, "Pack hooked entities in parallel too, when disabled they are packed on the main thread after the other entities. Callbacks always run on the main thread before packing."};
 
-static std::thread::id main_thread_id;
+struct PackWork_t
+{
+	int				nIdx;
+	edict_t			*pEdict;
+	CFrameSnapshot	*pSnapshot;
+};
 
-struct PackWork_t;
+//entities that have to be packed on the main thread while every other entity is packed in parallel
+//only written by SV_ComputeClientPacks before the engine starts packing
+static std::bitset<MAX_EDICTS> serial_edicts;
+static std::atomic<bool> defer_serial_packs{false};
+static std::mutex deferred_packs_mtx{};
+static std::vector<PackWork_t> deferred_packs{};
 
 DETOUR_DECL_STATIC1(PackWork_tProcess, void, PackWork_t &, item)
 {
+	if(defer_serial_packs && item.nIdx >= 0 && item.nIdx < MAX_EDICTS && serial_edicts.test(static_cast<std::size_t>(item.nIdx))) {
+		std::lock_guard<std::mutex> lock{deferred_packs_mtx};
+		deferred_packs.emplace_back(item);
+		return;
+	}
+
 	DETOUR_STATIC_CALL(PackWork_tProcess)(item);
 }
 
+//packs the entities PackWork_tProcess held back on the main thread in edict order
+static void pack_deferred() noexcept
+{
+	std::sort(deferred_packs.begin(), deferred_packs.end(),
+		[](const PackWork_t &lhs, const PackWork_t &rhs) noexcept -> bool {
+			return (lhs.nIdx < rhs.nIdx);
+		}
+	);
+	for(PackWork_t &item : deferred_packs) {
+		DETOUR_STATIC_CALL(PackWork_tProcess)(item);
+	}
+	deferred_packs.clear();
+}
+
+//called by SV_ComputeClientPacks right after the parallel packing finished
+//the deferred entities must be packed before the change infos are invalidated
+DETOUR_DECL_STATIC0(InvalidateSharedEdictChangeInfos, void)
+{
+	if(defer_serial_packs) {
+		defer_serial_packs = false;
+		pack_deferred();
+	}
+
+	DETOUR_STATIC_CALL(InvalidateSharedEdictChangeInfos)();
+}
+
 DETOUR_DECL_STATIC4(SV_PackEntity, void, int, edictIdx, edict_t *, edict, ServerClass *, pServerClass, CFrameSnapshot *, pSnapshot)
 {
 	DETOUR_STATIC_CALL(SV_PackEntity)(edictIdx, edict, pServerClass, pSnapshot);
@@ -1670,9 +3210,20 @@ static CDetour *SendTable_CalcDelta_detour{nullptr};
 static CDetour *SendTable_Encode_detour{nullptr};
 static CDetour *CFrameSnapshotManager_GetPackedEntity_detour{nullptr};
 
+static void apply_pending_overrides() noexcept;
+static void apply_pending_hooks() noexcept;
+
+static CDetour *PackWork_tProcess_detour{nullptr};
+static CDetour *InvalidateSharedEdictChangeInfos_detour{nullptr};
+
+static inline bool is_partial_parallel_pack_available() noexcept
+{ return (PackWork_tProcess_detour && InvalidateSharedEdictChangeInfos_detour); }
+
 DETOUR_DECL_STATIC3(SV_ComputeClientPacks, void, int, clientCount, CGameClient **, clients, CFrameSnapshot *, snapshot)
 {
-	packentity_params.reset(nullptr);
+	packentity_params = nullptr;
+
+	apply_pending_overrides();
 
 	std::vector<int> slots{};
 
@@ -1689,40 +3240,123 @@ DETOUR_DECL_STATIC3(SV_ComputeClientPacks, void, int, clientCount, CGameClient *
 
 	bool any_hook{false};
 
-	const hooks_t &chooks{hooks};
+	hook_results.begin_tick();
 
-	for(int i{0}; i < snapshot->m_nValidEntities; ++i) {
-		int idx{snapshot->m_pValidEntities[i]};
-		unsigned long ref{::IndexToReference(idx)};
+	for(Sample::batch_listener_t &it : g_Sample.batch_listeners) {
+		it.entities.clear();
+	}
+
+	//entities only hooked through their class, in snapshot order which is by index
+	static std::vector<int> class_edicts{};
+	class_edicts.clear();
+
+	//every entity still has to be visited for the listeners and to find the ones with class hooks
+	if(!g_Sample.pack_ent_listeners.empty() || !g_Sample.batch_listeners.empty() || !class_hooks.empty()) {
+		for(int i{0}; i < snapshot->m_nValidEntities; ++i) {
+			int idx{snapshot->m_pValidEntities[i]};
+			unsigned long ref{::IndexToReference(idx)};
 
-		for(auto it : g_Sample.pack_ent_listeners) {
 			CBaseEntity *pEntity{::ReferenceToEntity(ref)};
-			if(pEntity) {
-				it->pre_pack_entity(pEntity);
+			if(!pEntity) {
+				continue;
 			}
-		}
 
-		hooks_t::const_iterator it_hook{chooks.find(ref)};
-		if(it_hook != chooks.cend()) {
-			if(!it_hook->second.callbacks.empty()) {
-				any_hook = true;
+			for(auto it : g_Sample.pack_ent_listeners) {
+				it->pre_pack_entity(pEntity);
 			}
-			if(slots_size > 0) {
-				bool any_per_client_func{false};
-				for(const auto &it_callback : it_hook->second.callbacks) {
-					if(it_callback.second.has_any_per_client_func()) {
-						any_per_client_func = true;
-						break;
-					}
-				}
-				if(any_per_client_func) {
-					entities.emplace_back(ref);
+
+			const ServerClass *pServer{snapshot->m_pEntities[idx].m_pClass};
+
+			for(Sample::batch_listener_t &it : g_Sample.batch_listeners) {
+				if(it.wants(pServer)) {
+					it.entities.emplace_back(pEntity);
 				}
 			}
+
+			if(!class_hooks.empty() && !is_edict_hooked(idx) && class_hooks.find(pServer) != class_hooks.cend()) {
+				class_edicts.emplace_back(idx);
+			}
+		}
+	}
+
+	for(const Sample::batch_listener_t &it : g_Sample.batch_listeners) {
+		if(!it.entities.empty()) {
+			it.listener->pre_pack_entities(it.entities.data(), it.entities.size());
+		}
+	}
+
+	//copied since a callback is free to hook or unhook something
+	static std::vector<int> tick_edicts{};
+	tick_edicts.clear();
+	std::set_union(hooked_edict_list.cbegin(), hooked_edict_list.cend(), class_edicts.cbegin(), class_edicts.cend(), std::back_inserter(tick_edicts));
+
+	for(int idx : tick_edicts) {
+		if(!is_in_snapshot(snapshot, idx)) {
+			continue;
+		}
+
+		unsigned long ref{::IndexToReference(idx)};
+		CBaseEntity *pEntity{::ReferenceToEntity(ref)};
+		if(!pEntity) {
+			continue;
+		}
+
+		hooks_t::iterator it_hook{hooks.find(ref)};
+		proxyhook_t *hook{(it_hook != hooks.end() && !it_hook->second.callbacks.empty()) ? &it_hook->second : nullptr};
+
+		class_hooks_t::iterator it_class{class_hooks.find(snapshot->m_pEntities[idx].m_pClass)};
+		proxyhook_t *class_hook{it_class != class_hooks.end() ? &it_class->second : nullptr};
+
+		if(hook || class_hook) {
+			any_hook = true;
+			evaluating_hooks = true;
+			evaluate_hooks(idx, ref, pEntity, hook, class_hook, slots);
+			evaluating_hooks = false;
+		}
+	}
+
+	apply_pending_hooks();
+
+	//built after every callback ran since a callback is free to hook or unhook something
+	if(any_hook) {
+		for(int idx : tick_edicts) {
+			if(!is_in_snapshot(snapshot, idx)) {
+				continue;
+			}
+
+			const unsigned long ref{::IndexToReference(idx)};
+
+			hooks_t::const_iterator it_hook{hooks.find(ref)};
+			const proxyhook_t *hook{(it_hook != hooks.cend() && !it_hook->second.callbacks.empty()) ? &it_hook->second : nullptr};
+
+			class_hooks_t::const_iterator it_class{class_hooks.find(snapshot->m_pEntities[idx].m_pClass)};
+			const proxyhook_t *class_hook{it_class != class_hooks.cend() ? &it_class->second : nullptr};
+
+			if(!hook && !class_hook) {
+				continue;
+			}
+
+			hook_results.add(idx, hook, class_hook);
+
+			if(!per_client_edicts.test(static_cast<std::size_t>(idx)) && (!class_hook || !is_class_per_client(class_hook->server_class))) {
+				continue;
+			}
+
+			//with the results already known there is nothing to encode per-client unless a callback changed something
+			const bool any_client_result{std::any_of(slots.cbegin(), slots.cend(),
+				[idx](int slot) noexcept -> bool {
+					return hook_results.has_client_result(idx, slot+1);
+				}
+			)};
+			if(any_client_result) {
+				entities.emplace_back(ref);
+			}
 		}
 	}
 
-	const bool any_per_client_hook{slots_size > 0 && entities.size() > 0};
+	//entities that had per-client data last tick still need one more pass to resend the props they overrode
+	const bool any_prev_per_client_hook{packentity_params_storage && !packentity_params_storage->entities.empty()};
+	const bool any_per_client_hook{slots_size > 0 && (entities.size() > 0 || any_prev_per_client_hook)};
 
 #if defined _DEBUG && 0
 	printf("slots = %i, entities = %i\n", slots.size(), entities.size());
@@ -1730,34 +3364,117 @@ DETOUR_DECL_STATIC3(SV_ComputeClientPacks, void, int, clientCount, CGameClient *
 #endif
 
 	if(any_per_client_hook) {
-		packentity_params.reset(new pack_entity_params_t{std::move(slots), std::move(entities), snapshot->m_ListIndex});
-		SendTable_Encode_detour->EnableDetour();
-		SendTable_CalcDelta_detour->EnableDetour();
-		CFrameSnapshotManager_GetPackedEntity_detour->EnableDetour();
-		do_writedelta_entities = true;
-	} else {
-		do_writedelta_entities = false;
-		CFrameSnapshotManager_GetPackedEntity_detour->DisableDetour();
-		SendTable_Encode_detour->DisableDetour();
-		SendTable_CalcDelta_detour->DisableDetour();
+		if(!packentity_params_storage) {
+			packentity_params_storage.reset(new pack_entity_params_t{});
+		}
+		packentity_params_storage->begin_tick(std::move(slots), std::move(entities), snapshot->m_ListIndex);
+		packentity_params = packentity_params_storage.get();
+
+		group_clients(*packentity_params);
+		packentity_params->assign_shadows();
+
+		//entities the engine won't encode again keep last tick's per-client data instead
+		//only the ones with a class that has nothing to reuse are forced to encode
+		for(entity_packs_t &packs : packentity_params->entity_data) {
+			if(packentity_params->link_prev(packs)) {
+				continue;
+			}
+			CBaseEntity *pEntity{::ReferenceToEntity(packs.ref)};
+			if(!pEntity) {
+				continue;
+			}
+			edict_t *edict{pEntity->GetNetworkable()->GetEdict()};
+			if(edict) {
+				gamehelpers->SetEdictStateChanged(edict, 0);
+			}
+		}
+
+		//entities that lost their per-client data might not be repacked otherwise
+		for(const entity_packs_t &packs : packentity_params->prev_entity_data) {
+			if(packentity_params->entity_index(packs.edict, packs.ref) != static_cast<std::size_t>(-1)) {
+				continue;
+			}
+			CBaseEntity *pEntity{::ReferenceToEntity(packs.ref)};
+			if(!pEntity) {
+				continue;
+			}
+			edict_t *edict{pEntity->GetNetworkable()->GetEdict()};
+			if(edict) {
+				gamehelpers->SetEdictStateChanged(edict, 0);
+			}
+		}
 	}
 
-	const bool parallel_pack{
-		!any_hook &&
+	do_writedelta_entities = any_per_client_hook;
+
+	bool parallel_pack{
+		(!any_hook || proxysend_parallel_pack.GetBool()) &&
 		g_Sample.is_parallel_pack_allowed()
 	};
 
+	//rather than packing everything on the main thread only the entities that need it are
+	if(!parallel_pack && is_partial_parallel_pack_available()) {
+		bool partial{std::none_of(g_Sample.pack_ent_listeners.cbegin(), g_Sample.pack_ent_listeners.cend(),
+			[](const proxysend::parallel_pack_listener *listener) noexcept -> bool {
+				return !listener->is_allowed();
+			}
+		)};
+
+		serial_edicts.reset();
+
+		for(const Sample::batch_listener_t &it : g_Sample.batch_listeners) {
+			if(!partial) {
+				break;
+			}
+			if(it.listener->is_allowed()) {
+				continue;
+			}
+			//without a class filter the listener could care about any entity
+			if(it.classes.empty()) {
+				partial = false;
+				break;
+			}
+			for(CBaseEntity *pEntity : it.entities) {
+				edict_t *edict{pEntity->GetNetworkable()->GetEdict()};
+				const int idx{edict ? gamehelpers->IndexOfEdict(edict) : -1};
+				if(idx >= 0 && idx < MAX_EDICTS) {
+					serial_edicts.set(static_cast<std::size_t>(idx));
+				}
+			}
+		}
+
+		if(partial) {
+			if(any_hook && !proxysend_parallel_pack.GetBool()) {
+				for(int idx : tick_edicts) {
+					serial_edicts.set(static_cast<std::size_t>(idx));
+				}
+			}
+
+			deferred_packs.clear();
+			defer_serial_packs = true;
+			parallel_pack = true;
+		}
+	}
+
 	//sv_parallel_sendsnapshot->SetValue(false);
 	sv_parallel_packentities->SetValue(parallel_pack);
 
+	hook_results_ready = any_hook;
 	in_compute_packs = true;
 	DETOUR_STATIC_CALL(SV_ComputeClientPacks)(clientCount, clients, snapshot);
+
+	//InvalidateSharedEdictChangeInfos didn't run, the held back entities would never be packed otherwise
+	defer_serial_packs = false;
+	if(!deferred_packs.empty()) {
+		pack_deferred();
+	}
+
 	in_compute_packs = false;
 
-	if(!sv_parallel_packentities->GetBool() && any_per_client_hook) {
-		SendTable_Encode_detour->DisableDetour();
-		SendTable_CalcDelta_detour->DisableDetour();
+	if(packentity_params) {
+		packentity_params->carry_prev();
 	}
+	hook_results_ready = false;
 }
 
 bool Sample::is_parallel_pack_allowed() const noexcept
@@ -1766,9 +3483,54 @@ bool Sample::is_parallel_pack_allowed() const noexcept
 		[](const parallel_pack_listener *listener) noexcept -> bool {
 			return !listener->is_allowed();
 		}
+	) && !std::any_of(batch_listeners.cbegin(), batch_listeners.cend(), 
+		[](const batch_listener_t &listener) noexcept -> bool {
+			return !listener.listener->is_allowed();
+		}
 	);
 }
 
+bool Sample::batch_listener_t::wants(const ServerClass *pClass) const noexcept
+{ return (classes.empty() || std::binary_search(classes.cbegin(), classes.cend(), pClass)); }
+
+bool Sample::add_batch_listener(const batch_pack_listener *ptr, const ServerClass *const *classes, std::size_t num_classes) noexcept
+{
+	batch_listeners_t::iterator it{std::find_if(batch_listeners.begin(), batch_listeners.end(),
+		[ptr](const batch_listener_t &listener) noexcept -> bool {
+			return (listener.listener == ptr);
+		}
+	)};
+	if(it == batch_listeners.end()) {
+		batch_listeners.emplace_back();
+		it = batch_listeners.end() - 1;
+		it->listener = ptr;
+	}
+
+	it->classes.clear();
+	if(classes) {
+		it->classes.assign(classes, classes + num_classes);
+		std::sort(it->classes.begin(), it->classes.end());
+		it->classes.erase(std::unique(it->classes.begin(), it->classes.end()), it->classes.end());
+	}
+
+	return true;
+}
+
+bool Sample::remove_batch_listener(const batch_pack_listener *ptr) noexcept
+{
+	batch_listeners_t::const_iterator it{std::find_if(batch_listeners.cbegin(), batch_listeners.cend(),
+		[ptr](const batch_listener_t &listener) noexcept -> bool {
+			return (listener.listener == ptr);
+		}
+	)};
+	if(it == batch_listeners.cend()) {
+		return false;
+	}
+
+	batch_listeners.erase(it);
+	return true;
+}
+
 bool Sample::add_listener(const parallel_pack_listener *ptr) noexcept
 {
 	if(std::find(pack_ent_listeners.cbegin(), pack_ent_listeners.cend(), ptr) != pack_ent_listeners.cend()) {
@@ -1790,73 +3552,28 @@ bool Sample::remove_listener(const parallel_pack_listener *ptr) noexcept
 	return true;
 }
 
-static void global_send_proxy(const SendProp *pProp, const void *pStructBase, const void *pData, DVariant *pOut, int iElement, int objectID)
+static void send_proxy(const proxyrestore_t &restore, const SendProp *pProp, const void *pStructBase, const void *pData, DVariant *pOut, int iElement, int objectID)
 {
-	proxyrestore_t *restore{nullptr};
-
-	if(objectID != -1) {
-		const hooks_t &chooks{hooks};
-		unsigned long ref{::IndexToReference(objectID)};
-		hooks_t::const_iterator it_hook{chooks.find(ref)};
-		if(it_hook != chooks.cend()) {
-			callbacks_t::const_iterator it_callback{it_hook->second.callbacks.find(pProp)};
-			if(it_callback != it_hook->second.callbacks.cend()) {
-				restore = it_callback->second.restore;
-				const int client{callback_t::get_current_client_entity()};
-				if(it_callback->second.can_call_fwd(client)) {
-					if(std::this_thread::get_id() == main_thread_id) {
-						opaque_ptr new_data{};
-						if(it_callback->second.fwd_call(client, pProp, pData, new_data, objectID)) {
-							it_callback->second.proxy_call(pProp, pStructBase, pData, new_data.get(), pOut, iElement, objectID);
-							return;
-						}
-					}
-				}
+	//callbacks only ever run in SV_ComputeClientPacks, anything encoded outside of it gets the real values
+	if(hook_results_ready) {
+		const hook_results_t::entry_t *entry{hook_results.find(objectID, restore.index)};
+		if(entry) {
+			const void *new_data{entry->callback->get_result(*entry->results, callback_t::get_current_client_entity())};
+			if(new_data) {
+				entry->callback->proxy_call(pProp, pStructBase, pData, new_data, pOut, iElement, objectID);
+				return;
 			}
 		}
 	}
 
-	if(!restore) {
-		const restores_t &crestores{restores};
-		restores_t::const_iterator it_restore{crestores.find(const_cast<SendProp *>(pProp))};
-		if(it_restore != crestores.cend()) {
-			restore = it_restore->second.get();
-		}
-	}
-
-	if(restore) {
-		restore->pRealProxy(pProp, pStructBase, pData, pOut, iElement, objectID);
-	}
+	restore.pRealProxy(pProp, pStructBase, pData, pOut, iElement, objectID);
 }
 
-static void game_frame(bool simulating) noexcept
+static void global_send_proxy(const SendProp *pProp, const void *pStructBase, const void *pData, DVariant *pOut, int iElement, int objectID)
 {
-	if(!simulating) {
-		return;
-	}
-
-	// dumb nonsense so clients are fully aware that our hooked edicts are changing.
-	// this looks hacky, and it is, but there is not a better way i could find
-	// after tearing my hair out for 3 days of research
-	// sappho.io
-	for (auto& hook : hooks)
-	{
-		unsigned long ref = hook.first; // hook.second.ref;
-		//for (auto& cb : hook.second.callbacks)
-		//{
-		//	cb.second.change_edict_state();
-		//}
-		CBaseEntity* pEntity = ::ReferenceToEntity(ref);
-		if (!pEntity)
-		{
-			continue;
-		}
-		edict_t* edict = pEntity->GetNetworkable()->GetEdict();
-		if (!edict)
-		{
-			continue;
-		}
-		gamehelpers->SetEdictStateChanged(edict, 0);
+	const proxyrestore_t *restore{find_restore(pProp)};
+	if(restore) {
+		send_proxy(*restore, pProp, pStructBase, pData, pOut, iElement, objectID);
 	}
 }
 
@@ -1864,25 +3581,48 @@ DETOUR_DECL_MEMBER1(CGameServer_SendClientMessages, void, bool, bSendSnapshots)
 {
 	DETOUR_MEMBER_CALL(CGameServer_SendClientMessages)(bSendSnapshots);
 
-	if(!sv_parallel_sendsnapshot->GetBool()) {
-		do_writedelta_entities = false;
-		CFrameSnapshotManager_GetPackedEntity_detour->DisableDetour();
+	do_writedelta_entities = false;
+
+	if(packentity_params) {
+		packentity_params->release_shadows();
 	}
 
-	packentity_params.reset(nullptr);
+	packentity_params = nullptr;
 }
 
 struct sm_sendprop_info_ex_t final : sm_sendprop_info_t
 {
 	SendTable *table;
+	//a datatable proxy on the way changes the struct the prop is read from
+	//so callbacks would not see the value being encoded at the prop offset
+	bool redirected;
 };
 
 static int utlVecOffsetOffset{-1};
 
+//datatable proxies that only pass the struct on, any other proxy is free to return a different one
+static bool is_non_modifying_proxy(SendTableProxyFn pProxy) noexcept
+{
+	if(!pProxy || pProxy == std_proxies->m_DataTableToDataTable || pProxy == std_proxies->m_SendLocalDataTable) {
+		return true;
+	}
+
+	if(std_proxies->m_ppNonModifiedPointerProxies) {
+		for(const CNonModifiedPointerProxy *it{*std_proxies->m_ppNonModifiedPointerProxies}; it; it = it->m_pNext) {
+			if(it->m_Fn == pProxy) {
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
 static bool UTIL_FindInSendTable(SendTable *pTable, 
 						  const char *name,
 						  sm_sendprop_info_ex_t *info,
-						  unsigned int offset) noexcept
+						  unsigned int offset,
+						  bool redirected = false) noexcept
 {
 	int props = pTable->GetNumProps();
 	for (int i = 0; i < props; ++i)
@@ -1910,12 +3650,15 @@ static bool UTIL_FindInSendTable(SendTable *pTable,
 					info->table = pTable;
 					info->prop = prop;
 					info->actual_offset = offset + *reinterpret_cast<size_t *>(reinterpret_cast<intptr_t>(pLengthProxy->GetExtraData()) + utlVecOffsetOffset);
+					info->redirected = redirected;
 					return true;
 				}
 			}
 			info->table = pTable;
 			info->prop = prop;
 			info->actual_offset = offset + info->prop->GetOffset();
+			//the children of a datatable are what gets hooked so its own proxy counts too
+			info->redirected = (redirected || (pInnerTable && !is_non_modifying_proxy(prop->GetDataTableProxyFn())));
 			return true;
 		}
 		if (pInnerTable)
@@ -1923,7 +3666,8 @@ static bool UTIL_FindInSendTable(SendTable *pTable,
 			if (UTIL_FindInSendTable(pInnerTable, 
 				name,
 				info,
-				offset + prop->GetOffset())
+				offset + prop->GetOffset(),
+				redirected || !is_non_modifying_proxy(prop->GetDataTableProxyFn()))
 				)
 			{
 				return true;
@@ -1931,147 +3675,769 @@ static bool UTIL_FindInSendTable(SendTable *pTable,
 		}
 	}
 
-	return false;
-}
+	return false;
+}
+
+using propinfo_t = std::unordered_map<std::string, sm_sendprop_info_ex_t>;
+using propinfos_t = std::unordered_map<ServerClass *, propinfo_t>;
+static propinfos_t propinfos;
+
+bool Sample::remove_serverclass_from_cache(ServerClass *pClass) noexcept
+{
+	propinfos_t::iterator it_props{propinfos.find(pClass)};
+	if(it_props == propinfos.cend()) {
+		return false;
+	}
+
+	propinfos.erase(it_props);
+	return true;
+}
+
+static bool FindSendPropInfo(ServerClass *pClass, std::string &&name, sm_sendprop_info_ex_t *info) noexcept
+{
+	propinfos_t::iterator it_props{propinfos.find(pClass)};
+	if(it_props == propinfos.cend()) {
+		it_props = propinfos.emplace(std::pair<ServerClass *, propinfo_t>{pClass, propinfo_t{}}).first;
+	}
+	if(it_props != propinfos.cend()) {
+		propinfo_t::iterator it_prop{it_props->second.find(name)};
+		if(it_prop == it_props->second.cend()) {
+			if(UTIL_FindInSendTable(pClass->m_pTable, name.c_str(), info, 0)) {
+				it_prop = it_props->second.emplace(std::pair<std::string, sm_sendprop_info_ex_t>{std::move(name), std::move(*info)}).first;
+			}
+		}
+		if(it_prop != it_props->second.cend()) {
+			*info = it_prop->second;
+			return true;
+		}
+	}
+	return false;
+}
+
+//changes to the hook maps requested while evaluate_hooks is iterating over them
+struct pending_hook_t final
+{
+	enum class op_t : unsigned char
+	{
+		hook,
+		unhook,
+		hook_class,
+		unhook_class,
+		entity_destroyed,
+		client_disconnected
+	};
+
+	op_t op{op_t::hook};
+	unsigned long ref{INVALID_EHANDLE_INDEX};
+	//edict of ref, it can't be looked up anymore once the entity is destroyed
+	int edict{-1};
+	const ServerClass *server_class{nullptr};
+	SendProp *prop{nullptr};
+	const char *name{nullptr};
+	int element{0};
+	prop_types type{prop_types::unknown};
+	int offset{0};
+	IPluginFunction *func{nullptr};
+	bool per_client{false};
+	bool batch{false};
+	int client{-1};
+};
+
+static std::vector<pending_hook_t> pending_hooks{};
+
+static void apply_hook(const pending_hook_t &op) noexcept;
+
+static void queue_or_apply_hook(pending_hook_t &&op) noexcept
+{
+	if(evaluating_hooks) {
+		pending_hooks.emplace_back(std::move(op));
+	} else {
+		apply_hook(op);
+	}
+}
+
+static void apply_pending_hooks() noexcept
+{
+	static std::vector<pending_hook_t> ops{};
+	if(pending_hooks.empty()) {
+		return;
+	}
+
+	std::swap(ops, pending_hooks);
+	for(const pending_hook_t &op : ops) {
+		apply_hook(op);
+	}
+	ops.clear();
+}
+
+static cell_t proxysend_handle_hook(IPluginContext *pContext, unsigned long ref, const ServerClass *pServer, int offset, SendProp *pProp, const char *prop_name, int element, SendTable *pTable, IPluginFunction *callback, bool per_client, bool batch)
+{
+	prop_types type{prop_types::unknown};
+	const proxyrestore_t *restore{find_restore(pProp)};
+	if(restore) {
+		type = restore->type;
+	} else {
+		type = guess_prop_type(pProp, pTable);
+	}
+	if(type == prop_types::unknown) {
+		return pContext->ThrowNativeError("Unsupported prop");
+	}
+	if(batch && !callback_t::supports_batch(type)) {
+		return pContext->ThrowNativeError("Unsupported prop for batch hooks %s", pProp->GetName());
+	}
+
+	pending_hook_t op{};
+	op.op = (pServer ? pending_hook_t::op_t::hook_class : pending_hook_t::op_t::hook);
+	op.ref = ref;
+	op.server_class = pServer;
+	op.prop = pProp;
+	op.name = prop_name;
+	op.element = element;
+	op.type = type;
+	op.offset = offset;
+	op.func = callback;
+	op.per_client = per_client;
+	op.batch = batch;
+	queue_or_apply_hook(std::move(op));
+
+	return 0;
+}
+
+//interface calls can come from any thread so they are only applied by SV_ComputeClientPacks
+struct pending_override_t final
+{
+	enum class op_t : unsigned char
+	{
+		add_callback,
+		remove_callback,
+		remove_callbacks,
+		set_value,
+		clear_value
+	};
+
+	op_t op{op_t::set_value};
+	int entity{-1};
+	std::string prop{};
+	int element{0};
+	int client{-1};
+	client_value_t value{};
+	const proxysend::client_override_callback *callback{nullptr};
+	IPluginContext *owner{nullptr};
+};
+
+static std::mutex pending_overrides_mtx{};
+static std::vector<pending_override_t> pending_overrides{};
+
+static void queue_override(pending_override_t &&op) noexcept
+{
+	std::lock_guard<std::mutex> lock{pending_overrides_mtx};
+	pending_overrides.emplace_back(std::move(op));
+}
+
+static void change_entity_state(unsigned long ref) noexcept
+{
+	CBaseEntity *pEntity{::ReferenceToEntity(ref)};
+	if(pEntity) {
+		edict_t *edict{pEntity->GetNetworkable()->GetEdict()};
+		if(edict) {
+			gamehelpers->SetEdictStateChanged(edict, 0);
+		}
+	}
+}
+
+static void erase_if_unused(hooks_t::iterator it_hook, callbacks_t::iterator it_callback) noexcept
+{
+	if(it_callback->second.function_count() == 0) {
+		it_hook->second.callbacks.erase(it_callback);
+	}
+	if(it_hook->second.callbacks.empty()) {
+		set_edict_hooked(it_hook->first, false);
+		hooks.erase(it_hook);
+	}
+}
+
+static void apply_override(const pending_override_t &op) noexcept
+{
+	using op_t = pending_override_t::op_t;
+
+	if(op.op == op_t::remove_callbacks) {
+		hooks_t::iterator it_hook{hooks.begin()};
+		while(it_hook != hooks.end()) {
+			bool removed{false};
+			callbacks_t::iterator it_callback{it_hook->second.callbacks.begin()};
+			while(it_callback != it_hook->second.callbacks.end()) {
+				if(it_callback->second.remove_override_callback(op.callback)) {
+					removed = true;
+					if(it_callback->second.function_count() == 0) {
+						it_callback = it_hook->second.callbacks.erase(it_callback);
+						continue;
+					}
+				}
+				++it_callback;
+			}
+			if(removed) {
+				change_entity_state(it_hook->first);
+			}
+			if(it_hook->second.callbacks.empty()) {
+				set_edict_hooked(it_hook->first, false);
+				it_hook = hooks.erase(it_hook);
+				continue;
+			}
+			++it_hook;
+		}
+		return;
+	}
+
+	CBaseEntity *pEntity{gamehelpers->ReferenceToEntity(op.entity)};
+	if(!pEntity) {
+		return;
+	}
+
+	ServerClass *pServer{pEntity->GetNetworkable()->GetServerClass()};
+
+	sm_sendprop_info_ex_t info{};
+	if(!FindSendPropInfo(pServer, std::string{op.prop}, &info)) {
+		return;
+	}
+	//override callbacks start from the value at the prop offset, fixed values don't read it
+	if(op.op == op_t::add_callback && info.redirected) {
+	#ifdef _DEBUG
+		printf("prop %s is behind a redirecting datatable proxy\n", op.prop.c_str());
+	#endif
+		return;
+	}
+
+	SendProp *pProp{info.prop};
+	int offset{info.actual_offset};
+	int element{0};
+	if(pProp->GetType() == DPT_DataTable) {
+		SendTable *pPropTable{pProp->GetDataTable()};
+		if(op.element < 0 || op.element >= pPropTable->GetNumProps()) {
+			return;
+		}
+		pProp = pPropTable->GetProp(op.element);
+		offset += pProp->GetOffset();
+		element = op.element;
+	}
+
+	const unsigned long ref{::EntityToReference(pEntity)};
+
+	hooks_t::iterator it_hook{hooks.find(ref)};
+
+	if(op.op == op_t::remove_callback || op.op == op_t::clear_value) {
+		if(it_hook == hooks.end()) {
+			return;
+		}
+		callbacks_t::iterator it_callback{it_hook->second.callbacks.find(pProp)};
+		if(it_callback == it_hook->second.callbacks.end()) {
+			return;
+		}
+
+		bool changed{false};
+		if(op.op == op_t::remove_callback) {
+			changed = it_callback->second.remove_override_callback(op.callback);
+		} else {
+			changed = it_callback->second.clear_override(op.client);
+		}
+
+		if(changed) {
+			change_entity_state(ref);
+			erase_if_unused(it_hook, it_callback);
+		}
+		return;
+	}
+
+	prop_types type{prop_types::unknown};
+	const proxyrestore_t *restore{find_restore(pProp)};
+	if(restore) {
+		type = restore->type;
+	} else {
+		type = guess_prop_type(pProp, info.table);
+	}
+	if(type == prop_types::unknown) {
+	#ifdef _DEBUG
+		printf("unsupported prop %s for override\n", op.prop.c_str());
+	#endif
+		return;
+	}
+
+	if(it_hook == hooks.end()) {
+		it_hook = hooks.emplace(std::pair<unsigned long, proxyhook_t>{ref, proxyhook_t{ref, nullptr}}).first;
+		set_edict_hooked(ref, true);
+	}
+
+	callback_t &callback{it_hook->second.get_callback(pProp, info.prop->GetName(), element, type, offset)};
+
+	bool changed{false};
+	if(op.op == op_t::add_callback) {
+		changed = callback.add_override_callback(op.callback);
+	} else {
+		opaque_ptr value{};
+		if(callback.client_value_to_value(op.value, value)) {
+			changed = callback.set_override(op.client, std::move(value), op.owner);
+		}
+	}
+
+	if(changed) {
+		change_entity_state(ref);
+	} else {
+		//a value of the wrong type could have created an empty callback
+		erase_if_unused(it_hook, it_hook->second.callbacks.find(pProp));
+	}
+}
+
+static void apply_pending_overrides() noexcept
+{
+	static std::vector<pending_override_t> ops{};
+
+	{
+		std::lock_guard<std::mutex> lock{pending_overrides_mtx};
+		if(pending_overrides.empty()) {
+			return;
+		}
+		std::swap(ops, pending_overrides);
+	}
+
+	for(const pending_override_t &op : ops) {
+		apply_override(op);
+	}
+
+	ops.clear();
+}
+
+void Sample::add_override_callback(int entity, const char *prop, int element, const client_override_callback *ptr) noexcept
+{
+	pending_override_t op{};
+	op.op = pending_override_t::op_t::add_callback;
+	op.entity = entity;
+	op.prop = prop;
+	op.element = element;
+	op.callback = ptr;
+	queue_override(std::move(op));
+}
+
+void Sample::remove_override_callback(int entity, const char *prop, int element, const client_override_callback *ptr) noexcept
+{
+	pending_override_t op{};
+	op.op = pending_override_t::op_t::remove_callback;
+	op.entity = entity;
+	op.prop = prop;
+	op.element = element;
+	op.callback = ptr;
+	queue_override(std::move(op));
+}
+
+void Sample::remove_override_callbacks(const client_override_callback *ptr) noexcept
+{
+	pending_override_t op{};
+	op.op = pending_override_t::op_t::remove_callbacks;
+	op.callback = ptr;
+	queue_override(std::move(op));
+}
+
+static void queue_client_value(int entity, const char *prop, int element, int client, client_value_t &&value, IPluginContext *owner = nullptr) noexcept
+{
+	pending_override_t op{};
+	op.owner = owner;
+	op.op = pending_override_t::op_t::set_value;
+	op.entity = entity;
+	op.prop = prop;
+	op.element = element;
+	op.client = client;
+	op.value = std::move(value);
+	queue_override(std::move(op));
+}
+
+void Sample::set_client_int(int entity, const char *prop, int element, int client, int value) noexcept
+{
+	client_value_t tmp{};
+	tmp.kind = client_value_t::kind_t::int_;
+	tmp.i = value;
+	queue_client_value(entity, prop, element, client, std::move(tmp));
+}
+
+void Sample::set_client_float(int entity, const char *prop, int element, int client, float value) noexcept
+{
+	client_value_t tmp{};
+	tmp.kind = client_value_t::kind_t::float_;
+	tmp.f = value;
+	queue_client_value(entity, prop, element, client, std::move(tmp));
+}
+
+void Sample::set_client_vector(int entity, const char *prop, int element, int client, const float value[3]) noexcept
+{
+	client_value_t tmp{};
+	tmp.kind = client_value_t::kind_t::vector;
+	tmp.vec[0] = value[0];
+	tmp.vec[1] = value[1];
+	tmp.vec[2] = value[2];
+	queue_client_value(entity, prop, element, client, std::move(tmp));
+}
+
+void Sample::set_client_string(int entity, const char *prop, int element, int client, const char *value) noexcept
+{
+	client_value_t tmp{};
+	tmp.kind = client_value_t::kind_t::string;
+	tmp.str = value;
+	queue_client_value(entity, prop, element, client, std::move(tmp));
+}
+
+void Sample::clear_client_value(int entity, const char *prop, int element, int client) noexcept
+{
+	pending_override_t op{};
+	op.op = pending_override_t::op_t::clear_value;
+	op.entity = entity;
+	op.prop = prop;
+	op.element = element;
+	op.client = client;
+	queue_override(std::move(op));
+}
+
+//natives only check the prop here, the value itself goes through the same queue as the interface
+//since a native can be called from inside a callback while the hooks are being evaluated
+static cell_t validate_client_value(IPluginContext *pContext, cell_t entity, const char *name, cell_t element, cell_t client, client_value_t::kind_t kind, bool check_type = true) noexcept
+{
+	CBaseEntity *pEntity{gamehelpers->ReferenceToEntity(entity)};
+	if(!pEntity) {
+		return pContext->ThrowNativeError("Invalid Entity Reference/Index %i", entity);
+	}
+
+	if(client != -1 && (client < 1 || client > playerhelpers->GetMaxClients())) {
+		return pContext->ThrowNativeError("Invalid client index %i", client);
+	}
+
+	ServerClass *pServer{pEntity->GetNetworkable()->GetServerClass()};
+
+	sm_sendprop_info_ex_t info{};
+	if(!FindSendPropInfo(pServer, std::string{name}, &info)) {
+		return pContext->ThrowNativeError("Could not find prop %s", name);
+	}
+
+	SendProp *pProp{info.prop};
+	if(pProp->GetType() == DPT_DataTable) {
+		SendTable *pPropTable{pProp->GetDataTable()};
+		if(element < 0 || element >= pPropTable->GetNumProps()) {
+			return pContext->ThrowNativeError("Invalid element %i for %s", element, name);
+		}
+		pProp = pPropTable->GetProp(element);
+	}
+
+	if(!check_type) {
+		return 0;
+	}
+
+	prop_types type{prop_types::unknown};
+	const proxyrestore_t *restore{find_restore(pProp)};
+	if(restore) {
+		type = restore->type;
+	} else {
+		type = guess_prop_type(pProp, info.table);
+	}
+
+	bool valid{false};
+	switch(kind) {
+		case client_value_t::kind_t::int_:
+		valid = (type != prop_types::unknown &&
+			type != prop_types::float_ &&
+			type != prop_types::vector &&
+			type != prop_types::qangle &&
+			type != prop_types::cstring &&
+			type != prop_types::tstring);
+		break;
+		case client_value_t::kind_t::float_:
+		valid = (type == prop_types::float_);
+		break;
+		case client_value_t::kind_t::vector:
+		valid = (type == prop_types::vector || type == prop_types::qangle);
+		break;
+		case client_value_t::kind_t::string:
+		valid = (type == prop_types::cstring || type == prop_types::tstring);
+		break;
+		default:
+		break;
+	}
+	if(!valid) {
+		return pContext->ThrowNativeError("Prop %s has a different type", name);
+	}
+
+	return 0;
+}
+
+static cell_t proxysend_set_client_value(IPluginContext *pContext, const cell_t *params) noexcept
+{
+	char *name_ptr;
+	pContext->LocalToString(params[2], &name_ptr);
+
+	cell_t ret{validate_client_value(pContext, params[1], name_ptr, params[5], params[3], client_value_t::kind_t::int_)};
+	if(ret != 0) {
+		return ret;
+	}
+
+	client_value_t value{};
+	value.kind = client_value_t::kind_t::int_;
+	value.i = params[4];
+	queue_client_value(params[1], name_ptr, params[5], params[3], std::move(value), pContext);
+	return 0;
+}
+
+static cell_t proxysend_set_client_float(IPluginContext *pContext, const cell_t *params) noexcept
+{
+	char *name_ptr;
+	pContext->LocalToString(params[2], &name_ptr);
+
+	cell_t ret{validate_client_value(pContext, params[1], name_ptr, params[5], params[3], client_value_t::kind_t::float_)};
+	if(ret != 0) {
+		return ret;
+	}
+
+	client_value_t value{};
+	value.kind = client_value_t::kind_t::float_;
+	value.f = sp_ctof(params[4]);
+	queue_client_value(params[1], name_ptr, params[5], params[3], std::move(value), pContext);
+	return 0;
+}
+
+static cell_t proxysend_set_client_vector(IPluginContext *pContext, const cell_t *params) noexcept
+{
+	char *name_ptr;
+	pContext->LocalToString(params[2], &name_ptr);
+
+	cell_t ret{validate_client_value(pContext, params[1], name_ptr, params[5], params[3], client_value_t::kind_t::vector)};
+	if(ret != 0) {
+		return ret;
+	}
+
+	cell_t *addr{nullptr};
+	pContext->LocalToPhysAddr(params[4], &addr);
 
-using propinfo_t = std::unordered_map<std::string, sm_sendprop_info_ex_t>;
-using propinfos_t = std::unordered_map<ServerClass *, propinfo_t>;
-static propinfos_t propinfos;
+	client_value_t value{};
+	value.kind = client_value_t::kind_t::vector;
+	value.vec[0] = sp_ctof(addr[0]);
+	value.vec[1] = sp_ctof(addr[1]);
+	value.vec[2] = sp_ctof(addr[2]);
+	queue_client_value(params[1], name_ptr, params[5], params[3], std::move(value), pContext);
+	return 0;
+}
 
-bool Sample::remove_serverclass_from_cache(ServerClass *pClass) noexcept
+static cell_t proxysend_set_client_string(IPluginContext *pContext, const cell_t *params) noexcept
 {
-	propinfos_t::iterator it_props{propinfos.find(pClass)};
-	if(it_props == propinfos.cend()) {
-		return false;
+	char *name_ptr;
+	pContext->LocalToString(params[2], &name_ptr);
+
+	cell_t ret{validate_client_value(pContext, params[1], name_ptr, params[5], params[3], client_value_t::kind_t::string)};
+	if(ret != 0) {
+		return ret;
 	}
 
-	propinfos.erase(it_props);
-	return true;
+	char *str_ptr;
+	pContext->LocalToString(params[4], &str_ptr);
+
+	client_value_t value{};
+	value.kind = client_value_t::kind_t::string;
+	value.str = str_ptr;
+	queue_client_value(params[1], name_ptr, params[5], params[3], std::move(value), pContext);
+	return 0;
 }
 
-static bool FindSendPropInfo(ServerClass *pClass, std::string &&name, sm_sendprop_info_ex_t *info) noexcept
+static cell_t proxysend_clear_client_value(IPluginContext *pContext, const cell_t *params) noexcept
 {
-	propinfos_t::iterator it_props{propinfos.find(pClass)};
-	if(it_props == propinfos.cend()) {
-		it_props = propinfos.emplace(std::pair<ServerClass *, propinfo_t>{pClass, propinfo_t{}}).first;
+	char *name_ptr;
+	pContext->LocalToString(params[2], &name_ptr);
+
+	cell_t ret{validate_client_value(pContext, params[1], name_ptr, params[4], params[3], client_value_t::kind_t::int_, false)};
+	if(ret != 0) {
+		return ret;
 	}
-	if(it_props != propinfos.cend()) {
-		propinfo_t::iterator it_prop{it_props->second.find(name)};
-		if(it_prop == it_props->second.cend()) {
-			if(UTIL_FindInSendTable(pClass->m_pTable, name.c_str(), info, 0)) {
-				it_prop = it_props->second.emplace(std::pair<std::string, sm_sendprop_info_ex_t>{std::move(name), std::move(*info)}).first;
-			}
+
+	g_Sample.clear_client_value(params[1], name_ptr, params[4], params[3]);
+	return 0;
+}
+
+static void proxysend_handle_unhook(hooks_t::iterator it_hook, unsigned long ref, const SendProp *pProp, const char *name, IPluginFunction *callback)
+{
+	callbacks_t::iterator it_callback{it_hook->second.callbacks.find(pProp)};
+	if(it_callback != it_hook->second.callbacks.end()) {
+		it_callback->second.remove_function(callback);
+	#ifdef _DEBUG
+		printf("removed func from %s %p callback for %i\n", name, pProp, ref);
+	#endif
+		if(it_callback->second.function_count() == 0) {
+		#ifdef _DEBUG
+			printf("removed callback %s %p for %i\n", name, pProp, ref);
+		#endif
+			it_hook->second.callbacks.erase(it_callback);
 		}
-		if(it_prop != it_props->second.cend()) {
-			*info = it_prop->second;
-			return true;
+	}
+}
+
+static void proxysend_handle_unhook_class(proxyhook_t &hook, const SendProp *pProp, IPluginFunction *callback) noexcept
+{
+	callbacks_t::iterator it_callback{hook.callbacks.find(pProp)};
+	if(it_callback != hook.callbacks.end()) {
+		it_callback->second.remove_function(callback);
+		if(it_callback->second.function_count() == 0) {
+			change_class_callback_state(it_callback->second);
+			hook.callbacks.erase(it_callback);
 		}
 	}
-	return false;
 }
 
-static cell_t proxysend_handle_hook(IPluginContext *pContext, hooks_t::iterator it_hook, unsigned long ref, int offset, SendProp *pProp, std::string &&prop_name, int element, SendTable *pTable, IPluginFunction *callback, bool per_client)
+static void remove_entity_hooks(unsigned long ref, int edict, const ServerClass *pServer) noexcept
 {
-	prop_types type{prop_types::unknown};
-	restores_t::const_iterator it_restore{restores.find(pProp)};
-	if(it_restore != restores.cend()) {
-		type = it_restore->second->type;
-	} else {
-		type = guess_prop_type(pProp, pTable);
+	hooks_t::iterator it_hook{hooks.find(ref)};
+	if(it_hook != hooks.end()) {
+		set_index_hooked(edict, false);
+		hooks.erase(it_hook);
 	}
-	if(type == prop_types::unknown) {
-		return pContext->ThrowNativeError("Unsupported prop");
+
+	class_hooks_t::iterator it_class{class_hooks.find(pServer)};
+	if(it_class != class_hooks.end()) {
+		for(auto &it_callback : it_class->second.callbacks) {
+			it_callback.second.entity_results.erase(edict);
+		}
 	}
+}
 
-#ifdef _DEBUG
-	printf("added %s %p hook for %i\n", pProp->GetName(), pProp, ref);
-#endif
+static void remove_client_values(int client) noexcept
+{
+	hooks_t::iterator it_hook{hooks.begin()};
+	while(it_hook != hooks.end()) {
+		bool erased{false};
+		callbacks_t::iterator it_callback{it_hook->second.callbacks.begin()};
+		while(it_callback != it_hook->second.callbacks.end()) {
+			if(it_callback->second.clear_override(client)) {
+				erased = true;
+				if(it_callback->second.function_count() == 0) {
+					it_callback = it_hook->second.callbacks.erase(it_callback);
+					continue;
+				}
+			}
+			++it_callback;
+		}
+		if(erased) {
+			change_entity_state(it_hook->first);
+		}
+		if(it_hook->second.callbacks.empty()) {
+			set_edict_hooked(it_hook->first, false);
+			it_hook = hooks.erase(it_hook);
+			continue;
+		}
+		++it_hook;
+	}
+}
 
-	it_hook->second.add_callback(pProp, std::move(prop_name), element, type, offset, callback, per_client);
+static void apply_hook(const pending_hook_t &op) noexcept
+{
+	using op_t = pending_hook_t::op_t;
 
-	return 0;
+	switch(op.op) {
+		case op_t::hook: {
+			CBaseEntity *pEntity{::ReferenceToEntity(op.ref)};
+			if(!pEntity) {
+				return;
+			}
+			hooks_t::iterator it_hook{hooks.find(op.ref)};
+			if(it_hook == hooks.end()) {
+				it_hook = hooks.emplace(std::pair<unsigned long, proxyhook_t>{op.ref, proxyhook_t{op.ref, nullptr}}).first;
+				set_edict_hooked(op.ref, true);
+			}
+		#ifdef _DEBUG
+			printf("added %s %p hook for %i\n", op.prop->GetName(), op.prop, op.ref);
+		#endif
+			it_hook->second.add_callback(op.prop, op.name, op.element, op.type, op.offset, op.func, op.per_client, op.batch);
+			edict_t *edict{pEntity->GetNetworkable()->GetEdict()};
+			if(edict) {
+				gamehelpers->SetEdictStateChanged(edict, op.offset);
+			}
+		} break;
+		case op_t::unhook: {
+			hooks_t::iterator it_hook{hooks.find(op.ref)};
+			if(it_hook != hooks.end()) {
+				proxysend_handle_unhook(it_hook, op.ref, op.prop, op.prop->GetName(), op.func);
+				if(it_hook->second.callbacks.empty()) {
+					set_edict_hooked(op.ref, false);
+					hooks.erase(it_hook);
+				}
+			}
+			change_entity_state(op.ref);
+		} break;
+		case op_t::hook_class: {
+			class_hooks_t::iterator it_class{class_hooks.find(op.server_class)};
+			if(it_class == class_hooks.end()) {
+				it_class = class_hooks.emplace(std::pair<const ServerClass *, proxyhook_t>{op.server_class, proxyhook_t{INVALID_EHANDLE_INDEX, op.server_class}}).first;
+			}
+			it_class->second.add_callback(op.prop, op.name, op.element, op.type, op.offset, op.func, op.per_client, false);
+		} break;
+		case op_t::unhook_class: {
+			class_hooks_t::iterator it_class{class_hooks.find(op.server_class)};
+			if(it_class != class_hooks.end()) {
+				proxysend_handle_unhook_class(it_class->second, op.prop, op.func);
+				if(it_class->second.callbacks.empty()) {
+					class_hooks.erase(it_class);
+				}
+			}
+		} break;
+		case op_t::entity_destroyed:
+		remove_entity_hooks(op.ref, op.edict, op.server_class);
+		break;
+		case op_t::client_disconnected:
+		remove_client_values(op.client);
+		break;
+	}
 }
 
-static cell_t proxysend_hook(IPluginContext *pContext, const cell_t *params) noexcept
+static cell_t proxysend_hook_impl(IPluginContext *pContext, cell_t entity, cell_t prop, cell_t func, bool per_client, bool batch) noexcept
 {
-	CBaseEntity *pEntity{gamehelpers->ReferenceToEntity(params[1])};
+	CBaseEntity *pEntity{gamehelpers->ReferenceToEntity(entity)};
 	if(!pEntity) {
-		return pContext->ThrowNativeError("Invalid Entity Reference/Index %i", params[1]);
+		return pContext->ThrowNativeError("Invalid Entity Reference/Index %i", entity);
 	}
 
 	char *name_ptr;
-	pContext->LocalToString(params[2], &name_ptr);
+	pContext->LocalToString(prop, &name_ptr);
 	std::string name{name_ptr};
 
-	IPluginFunction *callback{pContext->GetFunctionById(params[3])};
-
-	bool per_client = static_cast<bool>(params[4]);
+	IPluginFunction *callback{pContext->GetFunctionById(func)};
 
 	IServerNetworkable *pNetwork{pEntity->GetNetworkable()};
 	ServerClass *pServer{pNetwork->GetServerClass()};
 
 	sm_sendprop_info_ex_t info{};
 	if(!FindSendPropInfo(pServer, std::move(name), &info)) {
-		return pContext->ThrowNativeError("Could not find prop %s", name.c_str());
+		return pContext->ThrowNativeError("Could not find prop %s", name_ptr);
+	}
+	if(info.redirected) {
+		return pContext->ThrowNativeError("Prop %s is sent through a datatable proxy that changes its struct and can't be hooked", name_ptr);
 	}
 	SendTable *pTable{info.table};
 
 	SendProp *pProp{info.prop};
-	std::string prop_name{pProp->GetName()};
+	const char *prop_name{pProp->GetName()};
 
 	unsigned long ref = ::EntityToReference(pEntity);
 
-	hooks_t::iterator it_hook{hooks.find(ref)};
-	if(it_hook == hooks.end()) {
-		it_hook = hooks.emplace(std::pair<unsigned long, proxyhook_t>{ref, proxyhook_t{ref}}).first;
-	}
-
-	edict_t *edict{pEntity->GetNetworkable()->GetEdict()};
-
 	if(pProp->GetType() == DPT_DataTable) {
 		SendTable *pPropTable{pProp->GetDataTable()};
 		int NumProps{pPropTable->GetNumProps()};
 		for(int i = 0; i < NumProps; ++i) {
 			SendProp *pChildProp{pPropTable->GetProp(i)};
-			std::string tmp_name{prop_name};
 			int offset{info.actual_offset + pChildProp->GetOffset()};
-			cell_t ret{proxysend_handle_hook(pContext, it_hook, ref, offset, pChildProp, std::move(tmp_name), i, pTable, callback, per_client)};
+			cell_t ret{proxysend_handle_hook(pContext, ref, nullptr, offset, pChildProp, prop_name, i, pTable, callback, per_client, batch)};
 			if(ret != 0) {
 				return ret;
 			}
-			if(edict) {
-				gamehelpers->SetEdictStateChanged(edict, offset);
-			}
 		}
 		return 0;
 	}
 
-	cell_t ret{proxysend_handle_hook(pContext, it_hook, ref, info.actual_offset, pProp, std::move(prop_name), 0, pTable, callback, per_client)};
-	if(ret == 0) {
-		if(edict) {
-			gamehelpers->SetEdictStateChanged(edict, info.actual_offset);
-		}
-	}
-
-	return ret;
+	return proxysend_handle_hook(pContext, ref, nullptr, info.actual_offset, pProp, prop_name, 0, pTable, callback, per_client, batch);
 }
 
-static void proxysend_handle_unhook(hooks_t::iterator it_hook, unsigned long ref, const SendProp *pProp, const char *name, IPluginFunction *callback)
-{
-	callbacks_t::iterator it_callback{it_hook->second.callbacks.find(pProp)};
-	if(it_callback != it_hook->second.callbacks.end()) {
-		it_callback->second.remove_function(callback);
-	#ifdef _DEBUG
-		printf("removed func from %s %p callback for %i\n", name, pProp, ref);
-	#endif
-		if(it_callback->second.fwd->GetFunctionCount() == 0) {
-		#ifdef _DEBUG
-			printf("removed callback %s %p for %i\n", name, pProp, ref);
-		#endif
-			it_hook->second.callbacks.erase(it_callback);
-		}
-	}
-}
+static cell_t proxysend_hook(IPluginContext *pContext, const cell_t *params) noexcept
+{ return proxysend_hook_impl(pContext, params[1], params[2], params[3], static_cast<bool>(params[4]), false); }
+
+static cell_t proxysend_hook_batch(IPluginContext *pContext, const cell_t *params) noexcept
+{ return proxysend_hook_impl(pContext, params[1], params[2], params[3], true, true); }
 
 static cell_t proxysend_unhook(IPluginContext *pContext, const cell_t *params) noexcept
 {
@@ -2097,26 +4463,111 @@ static cell_t proxysend_unhook(IPluginContext *pContext, const cell_t *params) n
 
 	unsigned long ref = gamehelpers->EntityToReference(pEntity);
 
-	hooks_t::iterator it_hook{hooks.find(ref)};
-	if(it_hook != hooks.end()) {
-		if(pProp->GetType() == DPT_DataTable) {
-			SendTable *pPropTable{pProp->GetDataTable()};
-			int NumProps{pPropTable->GetNumProps()};
-			for(int i = 0; i < NumProps; ++i) {
-				SendProp *pChildProp{pPropTable->GetProp(i)};
-				proxysend_handle_unhook(it_hook, ref, pChildProp, name_ptr, callback);
-			}
-		} else {
-			proxysend_handle_unhook(it_hook, ref, pProp, name_ptr, callback);
+	pending_hook_t op{};
+	op.op = pending_hook_t::op_t::unhook;
+	op.ref = ref;
+	op.func = callback;
+
+	if(pProp->GetType() == DPT_DataTable) {
+		SendTable *pPropTable{pProp->GetDataTable()};
+		int NumProps{pPropTable->GetNumProps()};
+		for(int i = 0; i < NumProps; ++i) {
+			pending_hook_t child_op{op};
+			child_op.prop = pPropTable->GetProp(i);
+			queue_or_apply_hook(std::move(child_op));
 		}
-		if(it_hook->second.callbacks.empty()) {
-			hooks.erase(it_hook);
+	} else {
+		op.prop = info.prop;
+		queue_or_apply_hook(std::move(op));
+	}
+
+	return 0;
+}
+
+static cell_t proxysend_hook_class(IPluginContext *pContext, const cell_t *params) noexcept
+{
+	char *classname_ptr;
+	pContext->LocalToString(params[1], &classname_ptr);
+
+	ServerClass *pServer{gamehelpers->FindServerClass(classname_ptr)};
+	if(!pServer) {
+		return pContext->ThrowNativeError("Could not find class %s", classname_ptr);
+	}
+
+	char *name_ptr;
+	pContext->LocalToString(params[2], &name_ptr);
+	std::string name{name_ptr};
+
+	IPluginFunction *callback{pContext->GetFunctionById(params[3])};
+	const bool per_client{static_cast<bool>(params[4])};
+
+	sm_sendprop_info_ex_t info{};
+	if(!FindSendPropInfo(pServer, std::move(name), &info)) {
+		return pContext->ThrowNativeError("Could not find prop %s", name_ptr);
+	}
+	if(info.redirected) {
+		return pContext->ThrowNativeError("Prop %s is sent through a datatable proxy that changes its struct and can't be hooked", name_ptr);
+	}
+	SendTable *pTable{info.table};
+
+	SendProp *pProp{info.prop};
+	const char *prop_name{pProp->GetName()};
+
+	if(pProp->GetType() == DPT_DataTable) {
+		SendTable *pPropTable{pProp->GetDataTable()};
+		int NumProps{pPropTable->GetNumProps()};
+		for(int i = 0; i < NumProps; ++i) {
+			SendProp *pChildProp{pPropTable->GetProp(i)};
+			int offset{info.actual_offset + pChildProp->GetOffset()};
+			cell_t ret{proxysend_handle_hook(pContext, INVALID_EHANDLE_INDEX, pServer, offset, pChildProp, prop_name, i, pTable, callback, per_client, false)};
+			if(ret != 0) {
+				return ret;
+			}
 		}
+		return 0;
+	}
+
+	return proxysend_handle_hook(pContext, INVALID_EHANDLE_INDEX, pServer, info.actual_offset, pProp, prop_name, 0, pTable, callback, per_client, false);
+}
+
+static cell_t proxysend_unhook_class(IPluginContext *pContext, const cell_t *params) noexcept
+{
+	char *classname_ptr;
+	pContext->LocalToString(params[1], &classname_ptr);
+
+	ServerClass *pServer{gamehelpers->FindServerClass(classname_ptr)};
+	if(!pServer) {
+		return pContext->ThrowNativeError("Could not find class %s", classname_ptr);
+	}
+
+	char *name_ptr;
+	pContext->LocalToString(params[2], &name_ptr);
+
+	sm_sendprop_info_t info{};
+	if(!gamehelpers->FindSendPropInfo(pServer->GetName(), name_ptr, &info)) {
+		return pContext->ThrowNativeError("Could not find prop %s", name_ptr);
 	}
 
-	edict_t *edict{pEntity->GetNetworkable()->GetEdict()};
-	if(edict) {
-		gamehelpers->SetEdictStateChanged(edict, 0);
+	const SendProp *pProp{info.prop};
+
+	IPluginFunction *callback{pContext->GetFunctionById(params[3])};
+
+	pending_hook_t op{};
+	op.op = pending_hook_t::op_t::unhook_class;
+	op.server_class = pServer;
+	op.func = callback;
+
+	if(pProp->GetType() == DPT_DataTable) {
+		SendTable *pPropTable{pProp->GetDataTable()};
+		int NumProps{pPropTable->GetNumProps()};
+		for(int i = 0; i < NumProps; ++i) {
+			pending_hook_t child_op{op};
+			child_op.prop = pPropTable->GetProp(i);
+			queue_or_apply_hook(std::move(child_op));
+		}
+	} else {
+		op.prop = info.prop;
+		queue_or_apply_hook(std::move(op));
 	}
 
 	return 0;
@@ -2125,13 +4576,20 @@ static cell_t proxysend_unhook(IPluginContext *pContext, const cell_t *params) n
 static constexpr const sp_nativeinfo_t natives[]{
 	{"proxysend_hook", proxysend_hook},
 	{"proxysend_unhook", proxysend_unhook},
+	{"proxysend_hook_batch", proxysend_hook_batch},
+	{"proxysend_unhook_batch", proxysend_unhook},
+	{"proxysend_set_client_value", proxysend_set_client_value},
+	{"proxysend_set_client_float", proxysend_set_client_float},
+	{"proxysend_set_client_vector", proxysend_set_client_vector},
+	{"proxysend_set_client_string", proxysend_set_client_string},
+	{"proxysend_clear_client_value", proxysend_clear_client_value},
+	{"proxysend_hook_class", proxysend_hook_class},
+	{"proxysend_unhook_class", proxysend_unhook_class},
 	{nullptr, nullptr}
 };
 
 static CDetour *SV_ComputeClientPacks_detour{nullptr};
 static CDetour *SV_PackEntity_detour{nullptr};
-static CDetour *PackWork_tProcess_detour{nullptr};
-static CDetour *InvalidateSharedEdictChangeInfos_detour{nullptr};
 static CDetour *CGameServer_SendClientMessages_detour{nullptr};
 
 bool Sample::SDK_OnLoad(char *error, size_t maxlen, bool late) noexcept
@@ -2220,16 +4678,30 @@ bool Sample::SDK_OnLoad(char *error, size_t maxlen, bool late) noexcept
 #if 0
 	//SV_PackEntity_detour = DETOUR_CREATE_STATIC(SV_PackEntity, "SV_PackEntity");
 	//SV_PackEntity_detour->EnableDetour();
-
-	//PackWork_tProcess_detour = DETOUR_CREATE_STATIC(PackWork_tProcess, "PackWork_t::Process");
-	//PackWork_tProcess_detour->EnableDetour();
-
-	//InvalidateSharedEdictChangeInfos_detour = DETOUR_CREATE_STATIC(InvalidateSharedEdictChangeInfos, "InvalidateSharedEdictChangeInfos");
-	//InvalidateSharedEdictChangeInfos_detour->EnableDetour();
 #endif
 
+	//optional, without them entities that can't be packed in parallel make the whole tick serial
+	PackWork_tProcess_detour = DETOUR_CREATE_STATIC(PackWork_tProcess, "PackWork_t::Process");
+	InvalidateSharedEdictChangeInfos_detour = DETOUR_CREATE_STATIC(InvalidateSharedEdictChangeInfos, "InvalidateSharedEdictChangeInfos");
+	if(PackWork_tProcess_detour && InvalidateSharedEdictChangeInfos_detour) {
+		PackWork_tProcess_detour->EnableDetour();
+		InvalidateSharedEdictChangeInfos_detour->EnableDetour();
+	} else {
+		if(PackWork_tProcess_detour) {
+			PackWork_tProcess_detour->Destroy();
+			PackWork_tProcess_detour = nullptr;
+		}
+		if(InvalidateSharedEdictChangeInfos_detour) {
+			InvalidateSharedEdictChangeInfos_detour->Destroy();
+			InvalidateSharedEdictChangeInfos_detour = nullptr;
+		}
+	}
+
 	CGameServer_SendClientMessages_detour->EnableDetour();
 	SV_ComputeClientPacks_detour->EnableDetour();
+	SendTable_Encode_detour->EnableDetour();
+	SendTable_CalcDelta_detour->EnableDetour();
+	CFrameSnapshotManager_GetPackedEntity_detour->EnableDetour();
 
 	g_pEntityList = reinterpret_cast<CBaseEntityList *>(gamehelpers->GetGlobalEntityList());
 
@@ -2238,8 +4710,8 @@ bool Sample::SDK_OnLoad(char *error, size_t maxlen, bool late) noexcept
 	sharesys->AddInterface(myself, this);
 	sharesys->RegisterLibrary(myself, "proxysend");
 
-	smutils->AddGameFrameHook(game_frame);
 	plsys->AddPluginsListener(this);
+	playerhelpers->AddClientListener(this);
 
 	sharesys->AddNatives(myself, natives);
 
@@ -2279,7 +4751,6 @@ bool Sample::SDK_OnMetamodLoad(ISmmAPI *ismm, char *error, size_t maxlen, bool l
 
 	std_proxies = gamedll->GetStandardSendProxies();
 
-	main_thread_id = std::this_thread::get_id();
 
 	sv_parallel_packentities = g_pCVar->FindVar("sv_parallel_packentities");
 	sv_parallel_sendsnapshot = g_pCVar->FindVar("sv_parallel_sendsnapshot");
@@ -2290,28 +4761,49 @@ bool Sample::SDK_OnMetamodLoad(ISmmAPI *ismm, char *error, size_t maxlen, bool l
 
 void Sample::OnCoreMapEnd() noexcept
 {
+	hook_results.clear();
+	{
+		std::lock_guard<std::mutex> lock{pending_overrides_mtx};
+		pending_overrides.clear();
+	}
+	pending_hooks.clear();
 	hooks.clear();
+	hooked_edicts.reset();
+	hooked_edict_list.clear();
+	class_hooks.clear();
 	restores.clear();
+	restore_lookup.clear();
+	restore_index_count = 0;
+	free_restore_indices.clear();
 }
 
 void Sample::SDK_OnUnload() noexcept
 {
 	OnCoreMapEnd();
 
+	packentity_params = nullptr;
+	packentity_params_storage.reset(nullptr);
+
 	SendTable_CalcDelta_detour->Destroy();
 	SendTable_Encode_detour->Destroy();
 	SV_ComputeClientPacks_detour->Destroy();
 	//SV_PackEntity_detour->Destroy();
-	//PackWork_tProcess_detour->Destroy();
-	//InvalidateSharedEdictChangeInfos_detour->Destroy();
+	if(PackWork_tProcess_detour) {
+		PackWork_tProcess_detour->Destroy();
+		PackWork_tProcess_detour = nullptr;
+	}
+	if(InvalidateSharedEdictChangeInfos_detour) {
+		InvalidateSharedEdictChangeInfos_detour->Destroy();
+		InvalidateSharedEdictChangeInfos_detour = nullptr;
+	}
 	CGameServer_SendClientMessages_detour->Destroy();
 	CFrameSnapshotManager_GetPackedEntity_detour->Destroy();
 	CBaseServer_WriteDeltaEntities_detour->Destroy();
 
 	gameconfs->CloseGameConfigFile(gameconf);
 
-	smutils->RemoveGameFrameHook(game_frame);
 	plsys->RemovePluginsListener(this);
+	playerhelpers->RemoveClientListener(this);
 	if(g_pSDKHooks) {
 		g_pSDKHooks->RemoveEntityListener(this);
 	}
@@ -2323,28 +4815,79 @@ void Sample::OnEntityDestroyed(CBaseEntity *pEntity) noexcept
 		return;
 	}
 
-	const unsigned long ref{::EntityToReference(pEntity)};
-
-	hooks_t::iterator it_hook{hooks.find(ref)};
-	if(it_hook != hooks.end()) {
-		hooks.erase(it_hook);
-	}
+	pending_hook_t op{};
+	op.op = pending_hook_t::op_t::entity_destroyed;
+	op.ref = ::EntityToReference(pEntity);
+	op.edict = ::ReferenceToIndex(op.ref);
+	op.server_class = pEntity->GetNetworkable()->GetServerClass();
+	queue_or_apply_hook(std::move(op));
 }
 
 void Sample::OnPluginUnloaded(IPlugin *plugin) noexcept
 {
+	{
+		IPluginContext *owner{plugin->GetBaseContext()};
+		std::lock_guard<std::mutex> lock{pending_overrides_mtx};
+		pending_overrides.erase(std::remove_if(pending_overrides.begin(), pending_overrides.end(),
+			[owner](const pending_override_t &op) noexcept -> bool {
+				return (op.owner == owner);
+			}
+		), pending_overrides.end());
+
+		pending_hooks.erase(std::remove_if(pending_hooks.begin(), pending_hooks.end(),
+			[owner](const pending_hook_t &op) noexcept -> bool {
+				return (op.func && op.func->GetParentContext() == owner);
+			}
+		), pending_hooks.end());
+	}
+
+	class_hooks_t::iterator it_class{class_hooks.begin()};
+	while(it_class != class_hooks.end()) {
+		callbacks_t::iterator it_callback{it_class->second.callbacks.begin()};
+		while(it_callback != it_class->second.callbacks.end()) {
+			it_callback->second.remove_functions_of_plugin(plugin);
+			if(it_callback->second.function_count() == 0) {
+				change_class_callback_state(it_callback->second);
+				it_callback = it_class->second.callbacks.erase(it_callback);
+				continue;
+			}
+			++it_callback;
+		}
+		if(it_class->second.callbacks.empty()) {
+			it_class = class_hooks.erase(it_class);
+			continue;
+		}
+		++it_class;
+	}
+
 	hooks_t::iterator it_hook{hooks.begin()};
 	while(it_hook != hooks.end()) {
+		bool erased{false};
 		callbacks_t::iterator it_callback{it_hook->second.callbacks.begin()};
 		while(it_callback != it_hook->second.callbacks.end()) {
 			it_callback->second.remove_functions_of_plugin(plugin);
-			if(it_callback->second.fwd->GetFunctionCount() == 0) {
+			if(it_callback->second.clear_overrides_of_plugin(plugin)) {
+				erased = true;
+			}
+			if(it_callback->second.function_count() == 0) {
 				it_callback = it_hook->second.callbacks.erase(it_callback);
+				erased = true;
 				continue;
 			}
 			++it_callback;
 		}
+		//the real values need to be sent again, nothing else would mark the entity as changed
+		if(erased) {
+			CBaseEntity *pEntity{::ReferenceToEntity(it_hook->first)};
+			if(pEntity) {
+				edict_t *edict{pEntity->GetNetworkable()->GetEdict()};
+				if(edict) {
+					gamehelpers->SetEdictStateChanged(edict, 0);
+				}
+			}
+		}
 		if(it_hook->second.callbacks.empty()) {
+			set_edict_hooked(it_hook->first, false);
 			it_hook = hooks.erase(it_hook);
 			continue;
 		}
@@ -2352,6 +4895,24 @@ void Sample::OnPluginUnloaded(IPlugin *plugin) noexcept
 	}
 }
 
+void Sample::OnClientDisconnected(int client) noexcept
+{
+	//overrides are keyed by slot, the next client in it must not inherit them
+	{
+		std::lock_guard<std::mutex> lock{pending_overrides_mtx};
+		pending_overrides.erase(std::remove_if(pending_overrides.begin(), pending_overrides.end(),
+			[client](const pending_override_t &op) noexcept -> bool {
+				return ((op.op == pending_override_t::op_t::set_value || op.op == pending_override_t::op_t::clear_value) && op.client == client);
+			}
+		), pending_overrides.end());
+	}
+
+	pending_hook_t op{};
+	op.op = pending_hook_t::op_t::client_disconnected;
+	op.client = client;
+	queue_or_apply_hook(std::move(op));
+}
+
 bool Sample::QueryRunning(char *error, size_t maxlength)
 {
 	SM_CHECK_IFACE(SDKHOOKS, g_pSDKHooks);
@@ -45,7 +45,7 @@
  * @brief Sample implementation of the SDK Extension.
  * Note: Uncomment one of the pre-defined virtual functions in order to use it.
  */
-class Sample final : public SDKExtension, public IPluginsListener, public ISMEntityListener, public IConCommandBaseAccessor, public proxysend
+class Sample final : public SDKExtension, public IPluginsListener, public IClientListener, public ISMEntityListener, public IConCommandBaseAccessor, public proxysend
 {
 public:
 	using pack_ent_listeners_t = std::vector<const parallel_pack_listener *>;
@@ -53,14 +53,41 @@ public:
 
 	bool add_listener(const parallel_pack_listener *ptr) noexcept override final;
 	bool remove_listener(const parallel_pack_listener *ptr) noexcept override final;
+
+	struct batch_listener_t final
+	{
+		const batch_pack_listener *listener{nullptr};
+		//sorted, empty means every class
+		std::vector<const ServerClass *> classes{};
+		std::vector<CBaseEntity *> entities{};
+
+		bool wants(const ServerClass *pClass) const noexcept;
+	};
+
+	using batch_listeners_t = std::vector<batch_listener_t>;
+	batch_listeners_t batch_listeners{};
+
+	bool add_batch_listener(const batch_pack_listener *ptr, const ServerClass *const *classes, std::size_t num_classes) noexcept override final;
+	bool remove_batch_listener(const batch_pack_listener *ptr) noexcept override final;
 	bool remove_serverclass_from_cache(ServerClass *ptr) noexcept override final;
 	prop_types guess_prop_type(const SendProp *prop, const SendTable *table) const noexcept override final;
 
+	void add_override_callback(int entity, const char *prop, int element, const client_override_callback *ptr) noexcept override final;
+	void remove_override_callback(int entity, const char *prop, int element, const client_override_callback *ptr) noexcept override final;
+	void remove_override_callbacks(const client_override_callback *ptr) noexcept override final;
+
+	void set_client_int(int entity, const char *prop, int element, int client, int value) noexcept override final;
+	void set_client_float(int entity, const char *prop, int element, int client, float value) noexcept override final;
+	void set_client_vector(int entity, const char *prop, int element, int client, const float value[3]) noexcept override final;
+	void set_client_string(int entity, const char *prop, int element, int client, const char *value) noexcept override final;
+	void clear_client_value(int entity, const char *prop, int element, int client) noexcept override final;
+
 	bool is_parallel_pack_allowed() const noexcept;
 
 	virtual bool RegisterConCommandBase(ConCommandBase *pCommand);
 	virtual void OnCoreMapEnd() noexcept override final;
 	virtual void OnPluginUnloaded(IPlugin *plugin) noexcept override final;
+	virtual void OnClientDisconnected(int client) noexcept override final;
 	virtual void OnEntityDestroyed(CBaseEntity *pEntity) noexcept override final;
 
 	virtual void NotifyInterfaceDrop(SMInterface *pInterface);
@@ -114,4 +114,27 @@ void PackedEntity::SetServerAndClientClass( ServerClass *pServerClass, ClientCla
 		Assert( pServerClass->m_pTable );
 		SetShouldCheckCreationTick( pServerClass->m_pTable->HasPropsEncodedAgainstTickCount() );
 	}
-}
\ No newline at end of file
+}
+
+void PackedEntity::ShadowFrom( PackedEntity *pSource, void *pData, int nBits )
+{
+	m_pServerClass = pSource->m_pServerClass;
+	m_pClientClass = pSource->m_pClientClass;
+	m_nEntityIndex = pSource->m_nEntityIndex;
+	m_ReferenceCount = pSource->m_ReferenceCount;
+	m_pData = pData;
+	m_nBits = nBits;
+	m_pChangeFrameList = pSource->m_pChangeFrameList;
+	m_nSnapshotCreationTick = pSource->m_nSnapshotCreationTick;
+	m_nShouldCheckCreationTick = pSource->m_nShouldCheckCreationTick;
+	// WriteDeltaEntities culls props with these, keeps its capacity between uses
+	m_Recipients.CopyArray( pSource->m_Recipients.Base(), pSource->m_Recipients.Count() );
+}
+
+void PackedEntity::ClearShadow()
+{
+	m_pData = NULL;
+	m_nBits = 0;
+	m_pChangeFrameList = NULL;
+	m_Recipients.RemoveAll();
+}
@@ -104,6 +104,12 @@ public:
 
 	void				SetServerAndClientClass( ServerClass *pServerClass, ClientClass *pClientClass );
 
+	// Make this entity a view of pSource with different data.
+	// The data and change frame list are borrowed so ClearShadow must be called before this
+	// entity is reused or deleted, the recipients are copied.
+	void				ShadowFrom( PackedEntity *pSource, void *pData, int nBits );
+	void				ClearShadow();
+
 public:
 	
 	ServerClass *m_pServerClass;	// Valid on the server
@@ -1,9 +1,10 @@
 #pragma once
 
 #include <IShareSys.h>
+#include <cstddef>
 
 #define SMINTERFACE_PROXYSEND_NAME "proxysend"
-#define SMINTERFACE_PROXYSEND_VERSION 3
+#define SMINTERFACE_PROXYSEND_VERSION 5
 
 class proxysend : public SourceMod::SMInterface
 {
@@ -46,4 +47,50 @@ public:
 	};
 
 	virtual prop_types guess_prop_type(const SendProp *prop, const SendTable *table) const noexcept = 0;
+
+	//version 4
+
+	//called on the main thread once per client every tick before packing
+	//value starts with what the client would get, change it and return true to override it
+	//colors are packed as r | g << 8 | b << 16 | a << 24 and entities are references
+	class client_override_callback
+	{
+	public:
+		virtual bool override_int(int entity, const char *prop, int element, int client, int &value) const noexcept { return false; }
+		virtual bool override_float(int entity, const char *prop, int element, int client, float &value) const noexcept { return false; }
+		virtual bool override_vector(int entity, const char *prop, int element, int client, float value[3]) const noexcept { return false; }
+		virtual bool override_string(int entity, const char *prop, int element, int client, char *value, std::size_t size) const noexcept { return false; }
+	};
+
+	//every function below can be called from any thread including pack workers
+	//they are queued and take effect on the next tick, invalid entities or props are silently ignored
+	//so are props sent through a datatable proxy that points somewhere other than the entity itself
+	//element is only used when prop is an array
+	virtual void add_override_callback(int entity, const char *prop, int element, const client_override_callback *ptr) noexcept = 0;
+	virtual void remove_override_callback(int entity, const char *prop, int element, const client_override_callback *ptr) noexcept = 0;
+	virtual void remove_override_callbacks(const client_override_callback *ptr) noexcept = 0;
+
+	//the value is sent to that client as is without any callback running, a client of -1 means every client
+	virtual void set_client_int(int entity, const char *prop, int element, int client, int value) noexcept = 0;
+	virtual void set_client_float(int entity, const char *prop, int element, int client, float value) noexcept = 0;
+	virtual void set_client_vector(int entity, const char *prop, int element, int client, const float value[3]) noexcept = 0;
+	virtual void set_client_string(int entity, const char *prop, int element, int client, const char *value) noexcept = 0;
+	virtual void clear_client_value(int entity, const char *prop, int element, int client) noexcept = 0;
+
+	//version 5
+
+	//same as parallel_pack_listener but gets every entity being packed in a single call each tick
+	class batch_pack_listener
+	{
+	public:
+		virtual bool is_allowed() const noexcept { return true; }
+		virtual void pre_pack_entities(CBaseEntity *const *entities, std::size_t count) const noexcept {}
+		virtual void pre_write_deltas() const noexcept {}
+		virtual void post_write_deltas() const noexcept {}
+	};
+
+	//only entities of the given classes are passed to pre_pack_entities, all of them when classes is null or empty
+	//adding a listener that was already added replaces its classes
+	virtual bool add_batch_listener(const batch_pack_listener *ptr, const ServerClass *const *classes, std::size_t num_classes) noexcept = 0;
+	virtual bool remove_batch_listener(const batch_pack_listener *ptr) noexcept = 0;
 };